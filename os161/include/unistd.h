@@ -10,6 +10,7 @@
  */
 #include <kern/unistd.h>
 #include <kern/ioctl.h>
+#include <kern/sysbatch.h>
 
 
 /*
@@ -122,6 +123,9 @@ time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
+pid_t spawn(const char *prog, char *const *args);	/* fork+execv */
+int sysstat_reset(void);	/* zero the kernel's syscall counters */
+int sysbatch(struct sysreq *reqs, int nreqs);	/* many calls, one trap */
 
 /*
  * These are not themselves system calls, but wrapper routines in libc.
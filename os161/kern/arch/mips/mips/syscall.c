@@ -10,17 +10,440 @@
 #include <addrspace.h>
 #include <array.h>
 #include <vfs.h>
+#include <vnode.h>
+#include <uio.h>
+#include <file.h>
+#include <kern/limits.h>
+#include <kern/stat.h>
 #include "syscall.h"
 #include <kern/unistd.h>
 #include <clock.h>
+#include <kern/sysbatch.h>
 
 
-#define MAX_PATH_LEN 128
 #define MINBRKCHK -98304
 #define MAXBRKCHK 98304
 extern procContBlock * listProcesses[MAX_PID];
 extern struct thread* curthread;
 
+/*
+ * The syscall table. Each entry gives the handler, which gets the
+ * arguments as raw register values (and the trapframe, for fork), the
+ * number and kinds of arguments, and flags:
+ *
+ *    SCF_NORETURN - doesn't come back on success (_exit, execv), so
+ *                   it is counted on the way in and never timed.
+ *    SCF_NOBATCH  - can't be run from sysbatch, because it needs the
+ *                   caller's own trapframe or never returns.
+ *
+ * Unused call numbers have no handler and fail with ENOSYS.
+ */
+
+#define SCA_INT   0	/* integer or descriptor */
+#define SCA_PTR   1	/* user pointer; checked in syscall_run */
+
+#define SCF_NORETURN  0x1
+#define SCF_NOBATCH   0x2
+
+typedef int (*syscall_handler)(const u_int32_t *args, struct trapframe *tf,
+			       int32_t *retval);
+
+struct syscall_desc {
+	const char *sc_name;
+	syscall_handler sc_handler;
+	int sc_nargs;
+	unsigned char sc_argtypes[4];
+	int sc_flags;
+};
+
+/*
+ * Per-syscall counters, updated with interrupts off. Time is in
+ * nanoseconds, kept as seconds plus nanoseconds so the total doesn't
+ * overflow.
+ */
+struct syscall_stats {
+	u_int32_t ss_calls;
+	u_int32_t ss_errors;
+	time_t ss_totsecs;
+	u_int32_t ss_totnsecs;
+	u_int32_t ss_maxnsecs;
+};
+
+/* Adapters from raw arguments to the handlers' real signatures */
+
+static
+int
+sc_reboot(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	(void)rv;
+	return sys_reboot(a[0]);
+}
+
+static
+int
+sc_open(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_open((userptr_t)a[0], a[1], rv);
+}
+
+static
+int
+sc_read(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_read(a[0], (userptr_t)a[1], a[2], rv);
+}
+
+static
+int
+sc_write(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_write(a[0], (userptr_t)a[1], a[2], rv);
+}
+
+static
+int
+sc_lseek(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_lseek(a[0], a[1], a[2], rv);
+}
+
+static
+int
+sc_close(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	(void)rv;
+	return syscall_close(a[0]);
+}
+
+static
+int
+sc_pipe(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_pipe((userptr_t)a[0], rv);
+}
+
+static
+int
+sc_dup2(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_dup2(a[0], a[1], rv);
+}
+
+static
+int
+sc_spawn(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_spawn((userptr_t)a[0], (userptr_t)a[1], rv);
+}
+
+static
+int
+sc_fork(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)a;
+	return syscall_fork(tf, rv);
+}
+
+static
+int
+sc_waitpid(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_waitpid(a[0], (userptr_t)a[1], a[2], rv);
+}
+
+static
+int
+sc_getpid(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)a;
+	(void)tf;
+	return syscall_getpid(rv);
+}
+
+static
+int
+sc_exit(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_exit(a[0], rv);
+}
+
+static
+int
+sc_execv(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	(void)rv;
+	return syscall_execv((userptr_t)a[0], (userptr_t)a[1]);
+}
+
+static
+int
+sc_time(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_time((userptr_t)a[0], (userptr_t)a[1], rv);
+}
+
+static
+int
+sc_sbrk(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_sbrk(a[0], rv);
+}
+
+static
+int
+sc_batch(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)tf;
+	return syscall_batch((userptr_t)a[0], a[1], rv);
+}
+
+static
+int
+sc_statreset(const u_int32_t *a, struct trapframe *tf, int32_t *rv)
+{
+	(void)a;
+	(void)tf;
+	(void)rv;
+	syscall_resetstats();
+	return 0;
+}
+
+#define I SCA_INT
+#define P SCA_PTR
+
+static const struct syscall_desc syscalls[] = {
+	[SYS__exit]	= { "_exit",	sc_exit,	1, { I },
+			    SCF_NORETURN|SCF_NOBATCH },
+	[SYS_execv]	= { "execv",	sc_execv,	2, { P, P },
+			    SCF_NORETURN|SCF_NOBATCH },
+	[SYS_fork]	= { "fork",	sc_fork,	0, { 0 },	SCF_NOBATCH },
+	[SYS_waitpid]	= { "waitpid",	sc_waitpid,	3, { I, P, I },	0 },
+	[SYS_open]	= { "open",	sc_open,	2, { P, I },	0 },
+	[SYS_read]	= { "read",	sc_read,	3, { I, P, I },	0 },
+	[SYS_write]	= { "write",	sc_write,	3, { I, P, I },	0 },
+	[SYS_close]	= { "close",	sc_close,	1, { I },	0 },
+	[SYS_reboot]	= { "reboot",	sc_reboot,	1, { I },	0 },
+	[SYS_sbrk]	= { "sbrk",	sc_sbrk,	1, { I },	0 },
+	[SYS_getpid]	= { "getpid",	sc_getpid,	0, { 0 },	0 },
+	[SYS_lseek]	= { "lseek",	sc_lseek,	3, { I, I, I },	0 },
+	[SYS_dup2]	= { "dup2",	sc_dup2,	2, { I, I },	0 },
+	[SYS_pipe]	= { "pipe",	sc_pipe,	1, { P },	0 },
+	[SYS___time]	= { "__time",	sc_time,	2, { P, P },	0 },
+	[SYS_spawn]	= { "spawn",	sc_spawn,	2, { P, P },	0 },
+	[SYS_sysstat_reset] = { "sysstat_reset", sc_statreset, 0, { 0 }, 0 },
+	[SYS_sysbatch]	= { "sysbatch",	sc_batch,	2, { P, I },	SCF_NOBATCH },
+};
+
+#undef I
+#undef P
+
+#define NSYSCALLS  (sizeof(syscalls) / sizeof(syscalls[0]))
+
+static struct syscall_stats syscallstats[NSYSCALLS];
+
+/*
+ * Charge one call of CALLNO that took SECS/NSECS and returned ERR.
+ */
+static
+void
+syscall_account(int callno, int err, time_t secs, u_int32_t nsecs)
+{
+	struct syscall_stats *ss = &syscallstats[callno];
+	int spl;
+
+	spl = splhigh();
+	ss->ss_calls++;
+	if (err) {
+		ss->ss_errors++;
+	}
+	ss->ss_totsecs += secs;
+	ss->ss_totnsecs += nsecs;
+	if (ss->ss_totnsecs >= 1000000000) {
+		ss->ss_totsecs++;
+		ss->ss_totnsecs -= 1000000000;
+	}
+	if (secs > 0) {
+		ss->ss_maxnsecs = 0xffffffff;
+	}
+	else if (nsecs > ss->ss_maxnsecs) {
+		ss->ss_maxnsecs = nsecs;
+	}
+	splx(spl);
+}
+
+void
+syscall_resetstats(void)
+{
+	int spl;
+
+	spl = splhigh();
+	bzero(syscallstats, sizeof(syscallstats));
+	splx(spl);
+}
+
+void
+syscall_printstats(void)
+{
+	struct syscall_stats ss;
+	unsigned i;
+	int spl;
+
+	kprintf("%-14s %8s %8s %15s %10s\n",
+		"syscall", "calls", "errors", "total (s)", "max (us)");
+	for (i = 0; i < NSYSCALLS; i++) {
+		spl = splhigh();
+		ss = syscallstats[i];
+		splx(spl);
+
+		if (syscalls[i].sc_handler == NULL || ss.ss_calls == 0) {
+			continue;
+		}
+		/* Seconds and microseconds apart, so long totals fit */
+		kprintf("%-14s %8u %8u %8u.%06u %10u\n", syscalls[i].sc_name,
+			ss.ss_calls, ss.ss_errors,
+			(unsigned)ss.ss_totsecs, ss.ss_totnsecs / 1000,
+			ss.ss_maxnsecs / 1000);
+	}
+}
+
+/*
+ * Look up and run one system call, and charge it to its counters. TF
+ * is NULL for calls made from sysbatch.
+ */
+static
+int
+syscall_run(int callno, const u_int32_t *args, struct trapframe *tf,
+	    int32_t *retval)
+{
+	const struct syscall_desc *sc;
+	u_int32_t a[4];
+	time_t secs1, secs2, dsecs;
+	u_int32_t nsecs1, nsecs2, dnsecs;
+	int i, err, spl;
+
+	if (callno < 0 || (unsigned)callno >= NSYSCALLS ||
+	    syscalls[callno].sc_handler == NULL) {
+		kprintf("Unknown syscall %d\n", callno);
+		return ENOSYS;
+	}
+	sc = &syscalls[callno];
+
+	if (tf == NULL && (sc->sc_flags & SCF_NOBATCH)) {
+		return EINVAL;
+	}
+
+	/*
+	 * Take only the arguments the call has, and turn away pointers
+	 * into the kernel before the handler ever sees them. (NULL is
+	 * up to the handler; some calls accept it.)
+	 */
+	for (i = 0; i < 4; i++) {
+		a[i] = 0;
+	}
+	for (i = 0; i < sc->sc_nargs; i++) {
+		a[i] = args[i];
+		if (sc->sc_argtypes[i] == SCA_PTR && a[i] >= USERTOP) {
+			syscall_account(callno, EFAULT, 0, 0);
+			return EFAULT;
+		}
+	}
+	args = a;
+
+	if (sc->sc_flags & SCF_NORETURN) {
+		/* Count it first; we only get past the handler if it failed */
+		syscall_account(callno, 0, 0, 0);
+		err = sc->sc_handler(args, tf, retval);
+		if (err) {
+			spl = splhigh();
+			syscallstats[callno].ss_errors++;
+			splx(spl);
+		}
+		return err;
+	}
+
+	gettime(&secs1, &nsecs1);
+	err = sc->sc_handler(args, tf, retval);
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &dsecs, &dnsecs);
+	syscall_account(callno, err, dsecs, dnsecs);
+	return err;
+}
+
+/*
+ * sysbatch: run NREQS independent calls described in the user's array
+ * REQS in one trap. The array is brought in and written back a chunk
+ * at a time, through a buffer that is kmalloc'd rather than put on
+ * the (small) kernel stack. Each request gets its own result and error;
+ * one failing doesn't stop the rest. Returns the number of requests
+ * run, which is less than NREQS only if the array itself went bad
+ * partway through.
+ */
+#define SYSBATCH_CHUNK  16
+
+int
+syscall_batch(userptr_t ureqs, int nreqs, int32_t *retval)
+{
+	struct sysreq *reqs;
+	userptr_t chunk;
+	int done, n, i, result = 0;
+
+	if (nreqs < 0) {
+		return EINVAL;
+	}
+
+	reqs = kmalloc(SYSBATCH_CHUNK * sizeof(struct sysreq));
+	if (reqs == NULL) {
+		return ENOMEM;
+	}
+
+	for (done = 0; done < nreqs; done += n) {
+		n = nreqs - done;
+		if (n > SYSBATCH_CHUNK) {
+			n = SYSBATCH_CHUNK;
+		}
+		chunk = (userptr_t)((struct sysreq *)ureqs + done);
+
+		result = copyin(chunk, reqs, n * sizeof(struct sysreq));
+		if (result) {
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			reqs[i].sr_retval = 0;
+			reqs[i].sr_error = syscall_run(reqs[i].sr_callno,
+						       reqs[i].sr_args, NULL,
+						       &reqs[i].sr_retval);
+		}
+
+		result = copyout(reqs, chunk, n * sizeof(struct sysreq));
+		if (result) {
+			break;
+		}
+	}
+
+	kfree(reqs);
+
+	if (done == 0 && nreqs > 0) {
+		return result;
+	}
+	*retval = done;
+	return 0;
+}
+
 /*
  * System call handler.
  *
@@ -58,19 +481,17 @@ extern struct thread* curthread;
  * arch/mips/include/types.h.)
  */
 
-/* call functions based on the call number.  */
 void
 mips_syscall(struct trapframe *tf)
 {
+	u_int32_t args[4];
 	int callno;
-	int spl;
 	int32_t retval;
 	int err;
 
 	assert(curspl==0);
 
-	callno = tf->tf_v0; // the system call number is
- 	//passed in the v0 register.
+	callno = tf->tf_v0;
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -83,59 +504,12 @@ mips_syscall(struct trapframe *tf)
 
 	retval = 0;
 
-	switch (callno) {
-
-		case SYS_reboot:
-		err = sys_reboot(tf->tf_a0);
-		break;
-
-		case SYS_read:
-		err = syscall_read(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
-		break;
-
-		case SYS_write:
-		err = syscall_write(tf->tf_a0, tf->tf_a1, tf->tf_a2, &retval);
-		break;
-
-		case SYS_fork:
-		err = syscall_fork(tf, &retval);
-		break;
-
-		case SYS_waitpid:
-		err = syscall_waitpid(tf->tf_a0,(int)tf->tf_a1, tf->tf_a2, &retval);
-		break;
-
-		case SYS_getpid:
-		spl = splhigh();
-		err = syscall_getpid(&retval);
-		splx(spl);
-		break;
-
-		case SYS__exit:
-		err = syscall_exit(tf->tf_a0, &retval);
-		break;
-
- 		case SYS_execv:
- 		spl = splhigh();
- 		err = syscall_execv(tf->tf_a0, tf->tf_a1);
- 		splx(spl);
- 		break;
-
- 		case SYS___time:
-		err = syscall_time((userptr_t)tf->tf_a0,
-				 (userptr_t)tf->tf_a1, &retval);
-		break;
-
-		case SYS_sbrk:
-		err = syscall_sbrk(tf->tf_a0, &retval);
-		break;
-
-	    default:
-		kprintf("Unknown syscall %d\n", callno);
-		err = ENOSYS;
-		break;
-	}
+	args[0] = tf->tf_a0;
+	args[1] = tf->tf_a1;
+	args[2] = tf->tf_a2;
+	args[3] = tf->tf_a3;
 
+	err = syscall_run(callno, args, tf, &retval);
 
 	if (err) {
 		/*
@@ -164,46 +538,223 @@ mips_syscall(struct trapframe *tf)
 
 }
 
+/*
+ * File syscalls. Descriptors index curthread->t_filetable (see file.h);
+ * each transfer goes to the vnode in a single VOP_READ/VOP_WRITE on the
+ * user's buffer, at the open file's offset.
+ */
+int
+syscall_open(userptr_t path, int flags, int32_t *retval)
+{
+	char *kpath;
+	int fd, result;
+
+	if (flags & ~(O_ACCMODE|O_CREAT|O_EXCL|O_TRUNC|O_APPEND)) {
+		return EINVAL;
+	}
+	if ((flags & O_ACCMODE) == O_ACCMODE) {
+		return EINVAL;
+	}
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result) {
+		kfree(kpath);
+		return result;
+	}
+
+	result = file_open(kpath, flags, &fd);
+	kfree(kpath);
+	if (result) {
+		return result;
+	}
+
+	*retval = fd;
+	return 0;
+}
+
+int
+syscall_close(int fd)
+{
+	return file_close(fd);
+}
+
 int 
-syscall_read(int fd, char* buf, size_t buflen, int32_t* retval)
+syscall_read(int fd, userptr_t buf, size_t buflen, int32_t* retval)
 {
-	if (fd != STDIN_FILENO){
+	struct openfile *of;
+	struct uio u;
+	int result;
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
+	}
+	if ((of->of_flags & O_ACCMODE) == O_WRONLY) {
 		return EBADF;
 	}
-	char kernloc;
-	int copyCheck;
-	kernloc = getch();
-	copyCheck = copyout(&kernloc, (userptr_t) buf, 1);
-	if(copyCheck != 0)
-		return EFAULT;
-	*retval = 1;
-	return 0;	
-}
 
+	/* Pipes and the console can block forever, and have no offset */
+	if (!of->of_seekable) {
+		mk_uuio(&u, buf, buflen, 0, UIO_READ);
+		result = VOP_READ(of->of_vnode, &u);
+		if (result == 0) {
+			*retval = buflen - u.uio_resid;
+		}
+		return result;
+	}
+
+	lock_acquire(of->of_lock);
+	mk_uuio(&u, buf, buflen, of->of_offset, UIO_READ);
+	result = VOP_READ(of->of_vnode, &u);
+	if (result == 0) {
+		of->of_offset = u.uio_offset;
+		*retval = buflen - u.uio_resid;
+	}
+	lock_release(of->of_lock);
 
+	return result;
+}
 
 int 
-syscall_write(int fd, char* buf, size_t nbytes, int* retval) {
-	int spl = splhigh();
-	int copyCheck;
-  	if(fd != STDOUT_FILENO && fd != STDERR_FILENO){
-  		splx(spl);
-  		return EBADF;
-  	}
-	char *kernloc = kmalloc(sizeof(char) * (nbytes));
-	copyCheck = copyin((const_userptr_t)buf, kernloc, nbytes);
-	if(copyCheck != 0){
-		splx(spl);
-		return EFAULT;
+syscall_write(int fd, userptr_t buf, size_t nbytes, int* retval)
+{
+	struct openfile *of;
+	struct stat st;
+	struct uio u;
+	int result;
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
 	}
-	kernloc[nbytes] = '\0';
-	int i = 0;
-	for(i; i < nbytes; i++){
-		putch(kernloc[i]);
+	if ((of->of_flags & O_ACCMODE) == O_RDONLY) {
+		return EBADF;
 	}
-	*retval = nbytes;
-	kfree(kernloc);
-	splx(spl);
+
+	/* As in syscall_read */
+	if (!of->of_seekable) {
+		mk_uuio(&u, buf, nbytes, 0, UIO_WRITE);
+		result = VOP_WRITE(of->of_vnode, &u);
+		if (result == 0) {
+			*retval = nbytes - u.uio_resid;
+		}
+		return result;
+	}
+
+	lock_acquire(of->of_lock);
+
+	if (of->of_flags & O_APPEND) {
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			lock_release(of->of_lock);
+			return result;
+		}
+		of->of_offset = st.st_size;
+	}
+
+	mk_uuio(&u, buf, nbytes, of->of_offset, UIO_WRITE);
+	result = VOP_WRITE(of->of_vnode, &u);
+	if (result == 0) {
+		of->of_offset = u.uio_offset;
+		*retval = nbytes - u.uio_resid;
+	}
+	lock_release(of->of_lock);
+
+	return result;
+}
+
+int
+syscall_lseek(int fd, off_t pos, int whence, int32_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	off_t newpos;
+	int result;
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(of->of_lock);
+
+	switch (whence) {
+	    case SEEK_SET:
+		newpos = pos;
+		break;
+	    case SEEK_CUR:
+		newpos = of->of_offset + pos;
+		break;
+	    case SEEK_END:
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			lock_release(of->of_lock);
+			return result;
+		}
+		newpos = st.st_size + pos;
+		break;
+	    default:
+		lock_release(of->of_lock);
+		return EINVAL;
+	}
+
+	if (newpos < 0) {
+		lock_release(of->of_lock);
+		return EINVAL;
+	}
+
+	/* Devices that can't seek (the console) say ESPIPE here */
+	result = VOP_TRYSEEK(of->of_vnode, newpos);
+	if (result == 0) {
+		of->of_offset = newpos;
+		*retval = newpos;
+	}
+
+	lock_release(of->of_lock);
+	return result;
+}
+
+/*
+ * The two descriptors are installed before we know whether the user's
+ * array is writable, so take them back out if it isn't.
+ */
+int
+syscall_pipe(userptr_t fds, int32_t *retval)
+{
+	int kfds[2];
+	int result;
+
+	result = file_pipe(kfds);
+	if (result) {
+		return result;
+	}
+
+	result = copyout(kfds, fds, sizeof(kfds));
+	if (result) {
+		file_close(kfds[0]);
+		file_close(kfds[1]);
+		return result;
+	}
+
+	*retval = 0;
+	return 0;
+}
+
+int
+syscall_dup2(int oldfd, int newfd, int32_t *retval)
+{
+	int result;
+
+	result = file_dup2(oldfd, newfd);
+	if (result) {
+		return result;
+	}
+
+	*retval = newfd;
 	return 0;
 }
 
@@ -247,8 +798,15 @@ syscall_fork(struct trapframe *tfptr, int *retval){
 	}	
 	*childTF = *tfptr; 
 
-	struct thread *child = kmalloc(sizeof(struct thread));
+	struct thread *child = NULL;
 	result =  thread_fork(curthread->t_name, (void*)childTF, (unsigned long)childVM, md_forkentry, &child);
+	if (result) {
+		/* out of PIDs, over the process limit, or out of memory */
+		kfree(childTF);
+		as_destroy(childVM);
+		splx(spl);
+		return result;
+	}
 
 	assert(child != NULL);
 	*retval = child->pID;
@@ -259,244 +817,392 @@ syscall_fork(struct trapframe *tfptr, int *retval){
 
 int 
 syscall_getpid(int32_t *retval){
-	int spl = splhigh();
-	splx(spl);
 	*retval = curthread->pID;
 	return 0;
 }
 
 int 
-syscall_waitpid(int pID, int status, int options, int32_t *retval) {
-	*retval = pID; 
-	int spl = splhigh();
+syscall_waitpid(int pID, userptr_t status, int options, int32_t *retval) {
+	procContBlock *pcb;
+	int exitcode;
 	int result;
-	int* status_ptr = &status;
-	if (status_ptr == NULL) {
+	int spl = splhigh();
+
+	/* Sleeps on the child's completion object unless WNOHANG */
+	result = proc_wait(pID, options, &pcb);
+	if (result) {
 		splx(spl);
-		return EFAULT;
+		return result;
 	}
+	splx(spl);
 
-	if(options != 0){
-		splx(spl);
-		return EINVAL;
+	if (!pcb->exited) {
+		/* WNOHANG and the child is still running */
+		*retval = 0;
+		return 0;
 	}
 
-	if(listProcesses[curthread->pID] == NULL){
-		splx(spl);
+	/*
+	 * Only we can reap our child, so the pcb stays put while
+	 * interrupts are on. Don't reap it if the copyout fails, so
+	 * the caller can try again with a good pointer.
+	 */
+	exitcode = pcb->exitCode;
+	result = copyout(&exitcode, status, sizeof(int));
+	if (result) {
 		return EFAULT;
 	}
 
-	if (pID < MIN_PID || pID > MAX_PID) {
-		splx(spl);
-		return EINVAL;
-	}
+	processRemove(pID);
+	*retval = pID;
+	return 0;
+}
 
-	if (pID == curthread->pID) {
-		splx(spl);
-		return EINVAL;
-	}
+int 
+syscall_exit(int exitcode, int32_t *retval) {
+	
+	int spl = splhigh();
 
-	if(listProcesses[pID] == NULL){
-			// panic("Process ID Does not exist");
-		splx(spl);
-		return EINVAL;
-		}
+	/*
+	 * Record our exit code for waitpid. Our children are handed
+	 * off in thread_exit, which walks only our own child list.
+	 */
+	listProcesses[curthread->pID]->exitCode = exitcode;
 
+	(void)retval;
+	splx(spl);
+	thread_exit(); 
+}
 
 
-	if(listProcesses[pID]->parentID != curthread->pID){
-		splx(spl);
-		return EINVAL;
-	}
+/*
+ * Argument vectors for execv and spawn.
+ *
+ * args_copyin gathers the user's NULL-terminated vector ARGS into a
+ * single ARG_MAX kernel buffer: the strings end to end, each padded
+ * to a word, with room held back at the end for the pointer array.
+ * There is no limit on the count beyond ARG_MAX itself; going over it
+ * is E2BIG.
+ *
+ * args_copyout puts the strings and then the pointer array below
+ * *STACKPTR in the current address space, one copyout each, moves
+ * *STACKPTR down past them and hands back the user address of argv.
+ *
+ * args_free releases the buffer; call it on every path.
+ */
+struct argbuf {
+	char *ab_buf;		/* ARG_MAX bytes */
+	size_t ab_len;		/* bytes of strings in ab_buf */
+	int ab_argc;
+};
 
+#define ARG_ALIGN(len)  (((len) + sizeof(userptr_t) - 1) & \
+			 ~(sizeof(userptr_t) - 1))
 
-	if(listProcesses[pID]->exited == 1){ 
-		assert(listProcesses[pID] != NULL);
-		*status_ptr = listProcesses[pID]->exitCode;
-		processRemove(pID);
-		*retval = pID;
-		
-		splx(spl);
-		return 0;
-	}
-	else{ 
+static
+void
+args_free(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	ab->ab_buf = NULL;
+}
 
-		assert(listProcesses[pID] != NULL);
+static
+int
+args_copyin(userptr_t args, struct argbuf *ab)
+{
+	userptr_t uarg;
+	size_t room, got, padded, ptrspace;
+	int result;
 
-			while(listProcesses[pID]->exited != 1){
-				thread_sleep(pID);
-			}
-		
-		thread_wakeup_1(pID);
-		*status_ptr = listProcesses[pID]->exitCode;
-		processRemove(pID);
-		
-		splx(spl);
-		
-		return 0;
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
 	}
-}
+	ab->ab_len = 0;
+	ab->ab_argc = 0;
 
-int 
-syscall_exit(int exitcode, int32_t *retval) {
-	
-	int spl = splhigh();
-	int current_pid = curthread->pID;
-
-	int j = 0;
-	for(j; j < MAX_PID; j++) { 
-		if(listProcesses[j] != NULL){
-			if(listProcesses[j]->parentID == current_pid)
-			{
-				listProcesses[j]->exitCode = exitcode;
-				listProcesses[j]->parentID = 1;
-			}
+	while (1) {
+		result = copyin((userptr_t)((userptr_t *)args + ab->ab_argc),
+				&uarg, sizeof(userptr_t));
+		if (result) {
+			break;
+		}
+		if (uarg == NULL) {
+			return 0;
+		}
+
+		/* leave space for this pointer and the terminating NULL */
+		ptrspace = (ab->ab_argc + 2) * sizeof(userptr_t);
+		if (ab->ab_len + ptrspace >= ARG_MAX) {
+			result = E2BIG;
+			break;
+		}
+		room = ARG_MAX - ab->ab_len - ptrspace;
+
+		result = copyinstr(uarg, ab->ab_buf + ab->ab_len, room, &got);
+		if (result == ENAMETOOLONG) {
+			result = E2BIG;
+		}
+		if (result) {
+			break;
 		}
+
+		padded = ARG_ALIGN(got);
+		if (padded > room) {
+			result = E2BIG;
+			break;
+		}
+		bzero(ab->ab_buf + ab->ab_len + got, padded - got);
+		ab->ab_len += padded;
+		ab->ab_argc++;
 	}
 
-	// *retval = 0;
-	splx(spl);
-	thread_exit(); 
+	args_free(ab);
+	return result;
 }
 
+static
+int
+args_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *retargv)
+{
+	userptr_t *uargv;
+	vaddr_t strings;
+	size_t off, nptrs;
+	int i, result;
 
-int syscall_execv(const char *prog_path, char **args) {
-	int result,check;
-	int nargs;
-	size_t bufflen;
+	strings = *stackptr - ab->ab_len;
+	result = copyout(ab->ab_buf, (userptr_t)strings, ab->ab_len);
+	if (result) {
+		return result;
+	}
 
-	// the prog_path is in user space, we need to copy it into kernel space
-	if(prog_path == NULL) {
-		return EINVAL;
+	/* Build the pointer array in the space args_copyin held back */
+	uargv = (userptr_t *)(ab->ab_buf + ab->ab_len);
+	off = 0;
+	for (i = 0; i < ab->ab_argc; i++) {
+		uargv[i] = (userptr_t)(strings + off);
+		off += ARG_ALIGN(strlen(ab->ab_buf + off) + 1);
 	}
-	if(args == NULL){
-		return EFAULT;
+	uargv[ab->ab_argc] = NULL;
+	assert(off == ab->ab_len);
+
+	nptrs = ab->ab_argc + 1;
+	*stackptr = strings - nptrs * sizeof(userptr_t);
+	result = copyout(uargv, (userptr_t)*stackptr,
+			 nptrs * sizeof(userptr_t));
+	if (result) {
+		return result;
 	}
 
-	// arguments badcall check
-	char** argcheck= (char**) kmalloc(sizeof(char**));
-	result = copyin((const_userptr_t)args, argcheck, sizeof(char *));
-	if(result) {
-		return EFAULT;
+	*retargv = (userptr_t)*stackptr;
+	return 0;
+}
+
+/*
+ * Load the program at PATH into a fresh address space with the
+ * arguments in AB on its stack, without disturbing the current one:
+ * the new space is switched in only for as long as it takes. On
+ * success hands back the address space and where to start it.
+ */
+struct progstart {
+	vaddr_t ps_entrypoint;
+	vaddr_t ps_stackptr;
+	int ps_argc;
+	userptr_t ps_argv;
+};
+
+static
+int
+load_program(char *path, struct argbuf *ab, struct addrspace **retas,
+	     struct progstart *ps)
+{
+	struct addrspace *oldas, *newas;
+	struct vnode *v;
+	int result;
+
+	result = vfs_open(path, O_RDONLY, &v);
+	if (result) {
+		return result;
 	}
 
-	// check program name
-	char* program = (char *) kmalloc(MAX_PATH_LEN);
-	if(program == NULL){
+	newas = as_create();
+	if (newas == NULL) {
+		vfs_close(v);
 		return ENOMEM;
 	}
-	check = copyinstr((userptr_t)prog_path, program, MAX_PATH_LEN, &bufflen);
-	if (check) {
-		return check;
-	}
 
-	if (bufflen == 1) {
-		return EINVAL;
+	oldas = curthread->t_vmspace;
+	curthread->t_vmspace = newas;
+	as_activate(newas);
+
+	result = load_elf(v, &ps->ps_entrypoint);
+	if (result == 0) {
+		result = as_define_stack(newas, &ps->ps_stackptr);
 	}
+	if (result == 0) {
+		result = args_copyout(ab, &ps->ps_stackptr, &ps->ps_argv);
+	}
+	ps->ps_argc = ab->ab_argc;
 
-	kfree(argcheck);
+	curthread->t_vmspace = oldas;
+	as_activate(oldas);
 
-	// count the number of arguments
-	char* nargscounter;
-	int i = 0;
-	while(1) {
-		result = copyin((userptr_t)&(args[i]), &nargscounter, (sizeof(userptr_t)));
-		if (result) {
-		//always want to check if the copy failed or not, returns 0 if it works 
-		//should probably free any kmallocs before returning
-			return EFAULT;
-		}
-		
-		if (nargscounter == NULL) break;
+	vfs_close(v);
 
-		i++;		
-	}	nargs = i;
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
-	char** argv;
-	argv = (char**)kmalloc(sizeof(char*)*(nargs+1));
+	*retas = newas;
+	return 0;
+}
 
-	if(argv == NULL){
+/*
+ * Copy in the program path and argument vector for execv or spawn.
+ */
+static
+int
+exec_copyin(userptr_t path, userptr_t args, char **retpath,
+	    struct argbuf *ab)
+{
+	char *kpath;
+	int result;
+
+	kpath = kmalloc(PATH_MAX);
+	if (kpath == NULL) {
 		return ENOMEM;
 	}
-
-	for(i = 0; i < nargs; i++){
-		argv[i] = (char*)kmalloc(sizeof(char)*MAX_PATH_LEN);
-		result = copyinstr((userptr_t)args[i],argv[i],MAX_PATH_LEN,&bufflen);
-		if(result){
-			return result;
-		}
+	result = copyinstr(path, kpath, PATH_MAX, NULL);
+	if (result == 0 && kpath[0] == '\0') {
+		result = EINVAL;
+	}
+	if (result == 0) {
+		result = args_copyin(args, ab);
+	}
+	if (result) {
+		kfree(kpath);
+		return result;
 	}
-	argv[nargs] = NULL;
-	// ********************** runprogram starts****************
 
-	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-	vaddr_t  *stackLoc[16];
-	int wordsInCopy;
+	*retpath = kpath;
+	return 0;
+}
 
-	result = vfs_open(program, O_RDONLY, &v);
+/*
+ * execv: replace our program. The new image is built in a separate
+ * address space, so if anything goes wrong we still have the old one
+ * to return the error to.
+ */
+int
+syscall_execv(userptr_t path, userptr_t args)
+{
+	struct addrspace *newas;
+	struct progstart ps;
+	struct argbuf ab;
+	char *kpath;
+	int result;
 
+	result = exec_copyin(path, args, &kpath, &ab);
 	if (result) {
 		return result;
 	}
 
-	// destroy the old addrspace
-	if(curthread->t_vmspace != NULL){
+	result = load_program(kpath, &ab, &newas, &ps);
+	kfree(kpath);
+	args_free(&ab);
+	if (result) {
+		return result;
+	}
+
+	/* No going back now */
+	if (curthread->t_vmspace != NULL) {
 		as_destroy(curthread->t_vmspace);
-		curthread->t_vmspace = NULL;
 	}
+	curthread->t_vmspace = newas;
+	as_activate(newas);
 
-	assert(curthread->t_vmspace == NULL);
+	/* Warp to user mode. */
+	md_usermode(ps.ps_argc, ps.ps_argv, ps.ps_stackptr,
+		    ps.ps_entrypoint);
 
-	// Create a new address space. 
-	curthread->t_vmspace = as_create();
-	if (curthread->t_vmspace==NULL) {
-		vfs_close(v);
-		return ENOMEM;
-	}
+	/* md_usermode does not return */
+	panic("md_usermode returned\n");
+	return EINVAL;
+}
 
-	// Activate it. 
+/*
+ * Where a spawned child starts: everything was set up by the parent,
+ * so just switch to the new address space and go.
+ */
+static
+void
+md_spawnentry(void *data, unsigned long vmspace)
+{
+	struct progstart ps = *(struct progstart *)data;
+
+	kfree(data);
+
+	curthread->t_vmspace = (struct addrspace *)vmspace;
+	assert(curthread->t_vmspace != NULL);
 	as_activate(curthread->t_vmspace);
 
-	// Load the executable. 
-	result = load_elf(v, &entrypoint); // Load an ELF executable user program into the current address space and
-	// returns the entry point (initial PC) for the program in ENTRYPOINT.
+	md_usermode(ps.ps_argc, ps.ps_argv, ps.ps_stackptr,
+		    ps.ps_entrypoint);
+
+	panic("md_usermode returned\n");
+}
+
+/*
+ * spawn: fork and execv in one step. Rather than copying our address
+ * space only for the child to throw it away, load the program straight
+ * into a fresh one. We do the loading ourselves so that any error
+ * comes back to the caller instead of killing a half-made child. The
+ * child inherits our open files and current directory as it would
+ * from fork.
+ */
+int
+syscall_spawn(userptr_t path, userptr_t args, int32_t *retval)
+{
+	struct addrspace *newas;
+	struct progstart *ps;
+	struct thread *child;
+	struct argbuf ab;
+	char *kpath;
+	int result;
+
+	ps = kmalloc(sizeof(struct progstart));
+	if (ps == NULL) {
+		return ENOMEM;
+	}
+
+	result = exec_copyin(path, args, &kpath, &ab);
 	if (result) {
-		vfs_close(v);
+		kfree(ps);
 		return result;
 	}
-	vfs_close(v);
 
-	result = as_define_stack(curthread->t_vmspace, &stackptr);
+	result = load_program(kpath, &ab, &newas, ps);
+	kfree(kpath);
+	args_free(&ab);
 	if (result) {
-		// thread_exit destroys curthread->t_vmspace 
+		kfree(ps);
 		return result;
 	}
 
-	//stuff for argument handling	
-	int j;
-	for(j = nargs - 1; j >= 0; j--){
-		int copylen = strlen(argv[j]);	
-		wordsInCopy = (int)4*((copylen/4)+1);
-		stackptr -= wordsInCopy;
-		copyout(argv[j], stackptr, wordsInCopy);
-		stackLoc[j]=stackptr;
+	result = thread_fork(curthread->t_name, ps, (unsigned long)newas,
+			     md_spawnentry, &child);
+	if (result) {
+		kfree(ps);
+		as_destroy(newas);
+		return result;
 	}
 
-	for(i = nargs; i >= 0; i--){
-		stackptr -= 4;
-		copyout(&stackLoc[i], stackptr, sizeof(void*));
-	}
-	/* Warp to user mode. */
-	md_usermode(nargs/*argc*/, stackptr /*userspace addr of argv*/,
-		    stackptr, entrypoint);
-	
-	/* md_usermode does not return */
-	panic("md_usermode returned\n");
-	return EINVAL;
+	*retval = child->pID;
+	return 0;
 }
 
-
 int
 syscall_time(time_t *seconds, unsigned long *nanoseconds, int *retval)
 {
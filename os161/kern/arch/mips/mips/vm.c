@@ -5,6 +5,7 @@
 #include <curthread.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <synch.h>
 #include <machine/spl.h>
 #include <machine/tlb.h>
 #include <vfs.h>
@@ -50,6 +51,7 @@ vm_bootstrap(void)
 		COREMAP[i].as = NULL;
 		COREMAP[i].id = i;
 		COREMAP[i].p_as = first_p_as + PAGE_SIZE * i;
+		COREMAP[i].refcount = 0;
 
 		if(i > staticPages) {
 			COREMAP[i].v_as = 0xDEADBEEF; 
@@ -239,12 +241,15 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		 * fault early in boot. Return EFAULT so as to panic
 		 * instead of getting into an infinite faulting loop.
 		 */
+		splx(spl);
 		return EFAULT;
 	}
 
 	unsigned int permissions = 0;
 	vaddr_t bottom_vm, top_vm;
 
+	/* Faults only look at the regions, so they take the lock shared */
+	rwlock_acquire_read(as->as_regionlock);
 	int i = 0;
 	for (i; i < array_getnum(as->as_regions); i++) {
 
@@ -255,11 +260,16 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		if(faultaddress >= bottom_vm && faultaddress < top_vm){
 			found = 1;
 			permissions = (cur->region_permis);
-			err = fix_faults(faultaddress, permissions); 
-			splx(spl);
-			return err;
+			break;
 		}
 	}
+	rwlock_release_read(as->as_regionlock);
+
+	if(found){
+		err = fix_faults(faultaddress, permissions); 
+		splx(spl);
+		return err;
+	}
 
 	//check stack if not found
 	if(!found){
@@ -441,4 +451,44 @@ paddr_t load_seg(int id, struct addrspace* as, vaddr_t v_as) {
 	return COREMAP[id].p_as;
 }
 
+paddr_t vm_loanpage(vaddr_t va) {
 
+	u_int32_t *pte;
+	paddr_t paddr;
+	int spl = splhigh();
+
+	if (va >= USERTOP || curthread->t_vmspace == NULL) {
+		splx(spl);
+		return 0;
+	}
+
+	pte = retEntry(curthread, va);
+	if (pte == NULL || !(*pte & PTE_PRESENT)) {
+		splx(spl);
+		return 0;
+	}
+
+	paddr = *pte & PAGE_FRAME;
+	COREMAP[(paddr - COREMAP[0].p_as) / PAGE_SIZE].refcount++;
+
+	splx(spl);
+	return paddr;
+}
+
+void vm_unloanpage(paddr_t paddr) {
+
+	struct C_ENTRY *entry;
+	int spl = splhigh();
+
+	entry = &COREMAP[(paddr - COREMAP[0].p_as) / PAGE_SIZE];
+	assert(entry->refcount > 0);
+	entry->refcount--;
+
+	// owner already gone (see as_destroy): the frame is ours to free
+	if (entry->refcount == 0 && entry->as == NULL && entry->state != 0) {
+		entry->v_as = 0;
+		entry->state = 0;
+		entry->length = 0;
+	}
+	splx(spl);
+}
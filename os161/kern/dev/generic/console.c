@@ -17,8 +17,9 @@
  * and (2) if the system crashes before we find a console, no output
  * at all may appear.
  *
- * Note that we have no input buffering; characters typed too rapidly
- * will be lost.
+ * Input is buffered a line at a time, with editing and echo done
+ * here rather than by each reader; characters typed past the end of
+ * the receive ring are dropped (with a beep).
  */
 
 #include <types.h>
@@ -44,6 +45,16 @@ static struct con_softc *the_console = NULL;
 static struct lock *con_userlock_read = NULL;
 static struct lock *con_userlock_write = NULL;
 
+/*
+ * Bounce buffers for user I/O, one per direction, each protected by
+ * the matching user lock above. Transfers move through them a chunk
+ * at a time, so a write of any size costs one uiomove per chunk
+ * instead of one per character, and nothing is allocated per call.
+ */
+#define CON_BOUNCESIZE  128
+static char con_rbounce[CON_BOUNCESIZE];
+static char con_wbounce[CON_BOUNCESIZE];
+
 //////////////////////////////////////////////////
 
 /*
@@ -94,6 +105,58 @@ putch_polled(struct con_softc *cs, int ch)
 
 //////////////////////////////////////////////////
 
+/*
+ * Transmit ring. con_txput queues a character, or hands it straight to
+ * the device if nothing is being sent. It never blocks; the caller
+ * makes sure there is room. Interrupts must be off.
+ */
+static
+void
+con_txput(struct con_softc *cs, int ch)
+{
+	assert(curspl>0);
+	assert(cs->cs_txcount < CON_TXBUFSIZE);
+
+	if (!cs->cs_txbusy) {
+		cs->cs_txbusy = 1;
+		cs->cs_send(cs->cs_devdata, ch);
+		return;
+	}
+	cs->cs_txbuf[(cs->cs_txhead + cs->cs_txcount) % CON_TXBUFSIZE] = ch;
+	cs->cs_txcount++;
+}
+
+/*
+ * Wait until the ring has room for another character.
+ * Interrupts must be off.
+ */
+static
+void
+con_txwait(struct con_softc *cs)
+{
+	assert(curspl>0);
+	while (cs->cs_txcount == CON_TXBUFSIZE) {
+		thread_sleep_on(&cs->cs_txwait);
+	}
+}
+
+/*
+ * Send everything still in the ring by polling. Used before printing
+ * with interrupts off, so that output doesn't come out of order.
+ */
+static
+void
+con_txflush_polled(struct con_softc *cs)
+{
+	assert(curspl>0);
+	while (cs->cs_txcount > 0) {
+		cs->cs_sendpolled(cs->cs_devdata, cs->cs_txbuf[cs->cs_txhead]);
+		cs->cs_txhead = (cs->cs_txhead + 1) % CON_TXBUFSIZE;
+		cs->cs_txcount--;
+	}
+	thread_wakeall(&cs->cs_txwait);
+}
+
 /*
  * Print a character, using interrupts to wait for I/O completion.
  */
@@ -102,32 +165,188 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	int spl = splhigh();
+	con_txwait(cs);
+	con_txput(cs, ch);
+	splx(spl);
 }
 
 /*
- * Read a character, using interrupts to wait for I/O completion.
+ * Read a character, waiting for a completed line if there is none.
+ * Interrupts must be off.
  */
 
+static
+int
+con_rxget(struct con_softc *cs)
+{
+	int ch;
+
+	assert(curspl>0);
+	while (cs->cs_rxready == 0) {
+		thread_sleep_on(&cs->cs_rxwait);
+	}
+	ch = cs->cs_rxbuf[cs->cs_rxhead];
+	cs->cs_rxhead = (cs->cs_rxhead + 1) % CON_RXBUFSIZE;
+	cs->cs_rxready--;
+	cs->cs_rxcount--;
+	return ch;
+}
+
 static
 int
 getch_intr(struct con_softc *cs)
 {
-	P(cs->cs_rsem);
-	return cs->cs_gotchar;
+	int ch, spl;
+
+	spl = splhigh();
+	ch = con_rxget(cs);
+	splx(spl);
+	return ch;
+}
+
+/*
+ * Echo a character of input. We're in an interrupt handler, so we
+ * can't wait for room in the transmit ring; if it's full, poll.
+ */
+static
+void
+con_echo(struct con_softc *cs, int ch)
+{
+	if (ch=='\n') {
+		con_echo(cs, '\r');
+	}
+	if (cs->cs_txcount < CON_TXBUFSIZE) {
+		con_txput(cs, ch);
+	}
+	else {
+		con_txflush_polled(cs);
+		putch_polled(cs, ch);
+	}
+}
+
+/* Last character of the line being edited */
+static
+int
+con_rxlast(struct con_softc *cs)
+{
+	return cs->cs_rxbuf[(cs->cs_rxhead + cs->cs_rxcount - 1)
+			    % CON_RXBUFSIZE];
+}
+
+/* Take back the last character typed, on screen too */
+static
+void
+con_rxerase(struct con_softc *cs)
+{
+	assert(cs->cs_rxcount > cs->cs_rxready);
+	cs->cs_rxcount--;
+	con_echo(cs, '\b');
+	con_echo(cs, ' ');
+	con_echo(cs, '\b');
+}
+
+static
+void
+con_rxappend(struct con_softc *cs, int ch)
+{
+	cs->cs_rxbuf[(cs->cs_rxhead + cs->cs_rxcount) % CON_RXBUFSIZE] = ch;
+	cs->cs_rxcount++;
+}
+
+/*
+ * Finish the line being edited and let readers have it. If lines
+ * nobody has read yet have filled the buffer, beep instead; the
+ * line stays open for editing.
+ */
+static
+void
+con_rxcommit(struct con_softc *cs)
+{
+	if (cs->cs_rxcount >= CON_RXBUFSIZE) {
+		beep();
+		return;
+	}
+	con_rxappend(cs, '\n');
+	con_echo(cs, '\n');
+	cs->cs_rxready = cs->cs_rxcount;
+	thread_wakeall(&cs->cs_rxwait);
 }
 
 /*
  * Called from underlying device when a read-ready interrupt occurs.
+ * This is the line discipline.
  */
 void
 con_input(void *vcs, int ch)
 {
 	struct con_softc *cs = vcs;
+	unsigned i;
+
+	if (ch=='\r') {
+		ch = '\n';
+	}
 
-	cs->cs_gotchar = ch;
-	V(cs->cs_rsem);
+	if (ch=='\n') {
+		/*
+		 * Printing characters leave one slot free, so a line being
+		 * typed can be finished unless unread lines fill the rest.
+		 */
+		con_rxcommit(cs);
+	}
+	else if (ch>=32 && ch<127) {
+		/* Only allow the normal 7-bit ascii */
+		if (cs->cs_rxcount < CON_RXBUFSIZE-1) {
+			con_rxappend(cs, ch);
+			con_echo(cs, ch);
+		}
+		else {
+			beep();
+		}
+	}
+	else if (ch=='\b' || ch==127) {
+		/* backspace */
+		if (cs->cs_rxcount > cs->cs_rxready) {
+			con_rxerase(cs);
+		}
+	}
+	else if (ch==3) {
+		/* ^C - throw the line away and hand back an empty one */
+		cs->cs_rxcount = cs->cs_rxready;
+		con_echo(cs, '^');
+		con_echo(cs, 'C');
+		con_rxcommit(cs);
+	}
+	else if (ch==18) {
+		/* ^R - reprint input */
+		con_echo(cs, '^');
+		con_echo(cs, 'R');
+		con_echo(cs, '\n');
+		for (i=cs->cs_rxready; i<cs->cs_rxcount; i++) {
+			con_echo(cs, cs->cs_rxbuf[(cs->cs_rxhead + i)
+						  % CON_RXBUFSIZE]);
+		}
+	}
+	else if (ch==21) {
+		/* ^U - erase line */
+		while (cs->cs_rxcount > cs->cs_rxready) {
+			con_rxerase(cs);
+		}
+	}
+	else if (ch==23) {
+		/* ^W - erase word */
+		while (cs->cs_rxcount > cs->cs_rxready &&
+		       con_rxlast(cs)==' ') {
+			con_rxerase(cs);
+		}
+		while (cs->cs_rxcount > cs->cs_rxready &&
+		       con_rxlast(cs)!=' ') {
+			con_rxerase(cs);
+		}
+	}
+	else {
+		beep();
+	}
 }
 
 /*
@@ -138,7 +357,22 @@ con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	if (cs->cs_txcount == 0) {
+		cs->cs_txbusy = 0;
+		return;
+	}
+
+	cs->cs_send(cs->cs_devdata, cs->cs_txbuf[cs->cs_txhead]);
+	cs->cs_txhead = (cs->cs_txhead + 1) % CON_TXBUFSIZE;
+	cs->cs_txcount--;
+
+	/*
+	 * Let blocked writers go once the ring is half empty, rather
+	 * than waking them for every character that drains.
+	 */
+	if (cs->cs_txcount == CON_TXBUFSIZE/2) {
+		thread_wakeall(&cs->cs_txwait);
+	}
 }
 
 //////////////////////////////////////////////////
@@ -160,6 +394,7 @@ putch(int ch)
 		putch_delayed(ch);
 	}
 	else if (in_interrupt || curspl>0) {
+		con_txflush_polled(cs);
 		putch_polled(cs, ch);
 	}
 	else {
@@ -200,12 +435,81 @@ con_close(struct device *dev)
 	return 0;
 }
 
+/*
+ * Read a line: characters go into the bounce buffer and out to the
+ * caller a bufferful at a time, stopping after a newline or when the
+ * caller's buffer is full.
+ */
+static
+int
+con_read(struct uio *uio)
+{
+	struct con_softc *cs = the_console;
+	size_t n;
+	char ch;
+	int result, spl, done = 0;
+
+	while (!done && uio->uio_resid > 0) {
+		n = 0;
+		spl = splhigh();
+		do {
+			/* Sleeps only until the first line is complete */
+			ch = con_rxget(cs);
+			con_rbounce[n++] = ch;
+			if (ch=='\n') {
+				done = 1;
+			}
+		} while (!done && n < CON_BOUNCESIZE && n < uio->uio_resid);
+		splx(spl);
+
+		result = uiomove(con_rbounce, n, uio);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Write: each bounce bufferful is appended to the transmit ring in one
+ * go, sleeping only if the ring fills up.
+ */
+static
+int
+con_write(struct uio *uio)
+{
+	struct con_softc *cs = the_console;
+	size_t n, i;
+	int result, spl;
+
+	while (uio->uio_resid > 0) {
+		n = uio->uio_resid;
+		if (n > CON_BOUNCESIZE) {
+			n = CON_BOUNCESIZE;
+		}
+		result = uiomove(con_wbounce, n, uio);
+		if (result) {
+			return result;
+		}
+		spl = splhigh();
+		for (i=0; i<n; i++) {
+			if (con_wbounce[i]=='\n') {
+				con_txwait(cs);
+				con_txput(cs, '\r');
+			}
+			con_txwait(cs);
+			con_txput(cs, con_wbounce[i]);
+		}
+		splx(spl);
+	}
+	return 0;
+}
+
 static
 int
 con_io(struct device *dev, struct uio *uio)
 {
 	int result;
-	char ch;
 	struct lock *lk;
 
 	(void)dev;  // unused
@@ -220,35 +524,15 @@ con_io(struct device *dev, struct uio *uio)
 	assert(lk != NULL);
 	lock_acquire(lk);
 
-	while (uio->uio_resid > 0) {
-		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				break;
-			}
-		}
-		else {
-			result = uiomove(&ch, 1, uio);
-			if (result) {
-				lock_release(lk);
-				return result;
-			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
-		}
+	if (uio->uio_rw==UIO_READ) {
+		result = con_read(uio);
+	}
+	else {
+		result = con_write(uio);
 	}
+
 	lock_release(lk);
-	return 0;
+	return result;
 }
 
 static
@@ -278,6 +562,7 @@ attach_console_to_vfs(struct con_softc *cs)
 	dev->d_close = con_close;
 	dev->d_io = con_io;
 	dev->d_ioctl = con_ioctl;
+	dev->d_submit = NULL;
 	dev->d_blocks = 0;
 	dev->d_blocksize = 1;
 	dev->d_data = cs;
@@ -300,7 +585,6 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -316,32 +600,24 @@ config_con(struct con_softc *cs, int unit)
 	}
 	assert(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
-		return ENOMEM;
-	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
-		return ENOMEM;
-	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
-	cs->cs_gotchar = 0;
+	cs->cs_rxhead = 0;
+	cs->cs_rxready = 0;
+	cs->cs_rxcount = 0;
+	threadlist_init(&cs->cs_rxwait);
+	cs->cs_txhead = 0;
+	cs->cs_txcount = 0;
+	cs->cs_txbusy = 0;
+	threadlist_init(&cs->cs_txwait);
 
 	the_console = cs;
 	con_userlock_read = rlk;
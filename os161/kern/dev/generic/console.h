@@ -1,13 +1,31 @@
 #ifndef _GENERIC_CONSOLE_H_
 #define _GENERIC_CONSOLE_H_
 
+#include <threadlist.h>
+
 /*
  * Device data for the hardware-independent system console.
  *
  * devdata, send, and sendpolled are provided by the underlying
  * device, and are to be initialized by the attach routine.
+ *
+ * Output goes through a transmit ring: writers append to it, and
+ * con_start (the write-done interrupt) sends the next character.
+ * Writers only sleep when the ring is full.
+ *
+ * Input goes into a receive ring with canonical line editing done at
+ * interrupt time (see con_input): characters are echoed, backspace,
+ * ^U, ^W, ^R and ^C are handled, and readers are only woken when a
+ * line is complete. cs_rxready counts the characters of completed
+ * lines, which is all readers may take; the rest of cs_rxcount is the
+ * line still being typed.
+ *
+ * Both rings are synchronized with spl.
  */
 
+#define CON_TXBUFSIZE  1024
+#define CON_RXBUFSIZE  256
+
 struct con_softc {
 	/* initialized by attach routine */
 	void *cs_devdata;
@@ -15,9 +33,20 @@ struct con_softc {
 	void (*cs_sendpolled)(void *devdata, int ch);
 
 	/* initialized by config routine */
-	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
-	int cs_gotchar;
+
+	/* receive ring */
+	char cs_rxbuf[CON_RXBUFSIZE];
+	unsigned cs_rxhead;		/* next character for readers */
+	unsigned cs_rxready;		/* characters in completed lines */
+	unsigned cs_rxcount;		/* all characters in the ring */
+	struct threadlist cs_rxwait;	/* readers waiting for a line */
+
+	/* transmit ring */
+	char cs_txbuf[CON_TXBUFSIZE];
+	unsigned cs_txhead;		/* next character to send */
+	unsigned cs_txcount;		/* characters waiting in the ring */
+	int cs_txbusy;			/* a character is on the wire */
+	struct threadlist cs_txwait;	/* writers waiting for room */
 };
 
 /*
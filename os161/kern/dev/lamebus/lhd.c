@@ -1,12 +1,31 @@
 /*
  * LAMEbus hard disk (lhd) driver.
+ *
+ * I/O is asynchronous underneath: requests (struct bioreq) are queued
+ * by lhd_submit, and the interrupt handler moves each sector between
+ * the request's buffer and the card and starts the next one. The card
+ * only does one sector per command, through a one-sector buffer.
+ *
+ * When a request finishes, the next is picked C-LOOK style: the
+ * waiting request at the lowest sector at or past the one the head
+ * was just on, or, if there are none, the lowest sector of all, so
+ * the head sweeps up the disk and jumps back. Every time a request is
+ * picked the others are charged a pass; one that has been passed over
+ * LHD_MAXPASS times goes next regardless, so nothing starves.
+ *
+ * A new request that starts right where a waiting request in the same
+ * direction ends is merged behind it and done straight after it, with
+ * no scheduling in between, up to LHD_MAXMERGE sectors in all.
+ *
+ * lhd_io, the synchronous interface, is built on top of lhd_submit.
  */
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
 #include <kern/errno.h>
 #include <machine/bus.h>
+#include <machine/spl.h>
+#include <thread.h>
 #include <uio.h>
 #include <vfs.h>
 #include <lamebus/lhd.h>
@@ -30,6 +49,13 @@
 /* Buffer (offset within slot)  */
 #define LHD_BUFFER      32768
 
+/* Scheduling limits; see above */
+#define LHD_MAXPASS     8
+#define LHD_MAXMERGE    64
+
+/* Most sectors lhd_io asks for in one request */
+#define LHD_BATCH       64
+
 /*
  * Shortcut for reading a register.
  */
@@ -66,15 +92,150 @@ int lhd_code_to_errno(struct lhd_softc *lh, int code)
 }
 
 /*
- * Record that an I/O has completed: save the result and poke the
- * completion semaphore.
+ * Start the next sector of the current request.
+ */
+static
+void
+lhd_startsect(struct lhd_softc *lh)
+{
+	struct bioreq *br = lh->lh_cur;
+	u_int32_t statval = LHD_WORKING;
+
+	if (br->br_write) {
+		memcpy(lh->lh_buf,
+		       (char *)br->br_data + lh->lh_cursect*LHD_SECTSIZE,
+		       LHD_SECTSIZE);
+		statval |= LHD_ISWRITE;
+	}
+
+	/* Tell it what sector we want... */
+	lhd_wreg(lh, LHD_REG_SECT, br->br_block + lh->lh_cursect);
+
+	/* and start the operation. */
+	lhd_wreg(lh, LHD_REG_STAT, statval);
+}
+
+/*
+ * Take the next request off the queue and start it, if there is one.
  */
 static
 void
-lhd_iodone(struct lhd_softc *lh, int err)
+lhd_startnext(struct lhd_softc *lh)
 {
-	lh->lh_result = err;
-	V(lh->lh_done);
+	struct bioreq *br, *pick, **pp, **pickp, **lowp;
+
+	assert(curspl>0);
+	assert(lh->lh_cur == NULL);
+
+	if (lh->lh_queue == NULL) {
+		return;
+	}
+
+	/* Anything waited long enough? The oldest is first. */
+	pickp = NULL;
+	for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->br_next) {
+		if ((*pp)->br_passed >= LHD_MAXPASS) {
+			pickp = pp;
+			break;
+		}
+	}
+
+	/* If not, C-LOOK */
+	if (pickp == NULL) {
+		lowp = NULL;
+		for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->br_next) {
+			br = *pp;
+			if (lowp == NULL || br->br_block < (*lowp)->br_block) {
+				lowp = pp;
+			}
+			if (br->br_block >= lh->lh_headpos &&
+			    (pickp == NULL ||
+			     br->br_block < (*pickp)->br_block)) {
+				pickp = pp;
+			}
+		}
+		if (pickp == NULL) {
+			pickp = lowp;
+		}
+	}
+
+	pick = *pickp;
+	*pickp = pick->br_next;
+	pick->br_next = NULL;
+
+	for (br = lh->lh_queue; br != NULL; br = br->br_next) {
+		br->br_passed++;
+	}
+
+	lh->lh_cur = pick;
+	lh->lh_cursect = 0;
+	lhd_startsect(lh);
+}
+
+/*
+ * Try to tack BR onto the end of a waiting request. Returns true if
+ * it worked.
+ */
+static
+int
+lhd_merge(struct lhd_softc *lh, struct bioreq *br)
+{
+	struct bioreq *q, *last;
+	u_int32_t total;
+
+	for (q = lh->lh_queue; q != NULL; q = q->br_next) {
+		total = q->br_nblocks;
+		for (last = q; last->br_merged != NULL; last = last->br_merged) {
+			total += last->br_merged->br_nblocks;
+		}
+		if (last->br_write == br->br_write &&
+		    last->br_block + last->br_nblocks == br->br_block &&
+		    total + br->br_nblocks <= LHD_MAXMERGE) {
+			last->br_merged = br;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A sector of the current request has finished with error code ERR.
+ * Go on to the next sector, or finish the request.
+ */
+static
+void
+lhd_sectdone(struct lhd_softc *lh, int err)
+{
+	struct bioreq *br = lh->lh_cur, *next;
+
+	assert(br != NULL);
+
+	if (err == 0 && !br->br_write) {
+		memcpy((char *)br->br_data + lh->lh_cursect*LHD_SECTSIZE,
+		       lh->lh_buf, LHD_SECTSIZE);
+	}
+	lh->lh_headpos = br->br_block + lh->lh_cursect;
+	lh->lh_cursect++;
+
+	if (err == 0 && lh->lh_cursect < br->br_nblocks) {
+		lhd_startsect(lh);
+		return;
+	}
+
+	/* This one's finished. br_done may free it, so look first. */
+	next = br->br_merged;
+	br->br_result = err;
+	br->br_done(br);
+
+	if (next != NULL) {
+		lh->lh_cur = next;
+		lh->lh_cursect = 0;
+		lhd_startsect(lh);
+	}
+	else {
+		lh->lh_cur = NULL;
+		lhd_startnext(lh);
+	}
 }
 
 /*
@@ -98,7 +259,7 @@ lhd_irq(void *vlh)
 	    case LHD_INVSECT:
 	    case LHD_MEDIA:
 		lhd_wreg(lh, LHD_REG_STAT, 0);
-		lhd_iodone(lh, lhd_code_to_errno(lh, val));
+		lhd_sectdone(lh, lhd_code_to_errno(lh, val));
 		break;
 	}
 }
@@ -164,8 +325,97 @@ lhd_reset(struct lhd_softc *lh)
 }
 #endif
 
+/*
+ * Queue a request.
+ */
+static
+int
+lhd_submit(struct device *d, struct bioreq *br)
+{
+	struct lhd_softc *lh = d->d_data;
+	struct bioreq **pp;
+	int s;
+
+	/* Don't allow I/O past the end of the disk. */
+	if (br->br_nblocks == 0 ||
+	    br->br_block + br->br_nblocks > lh->lh_dev.d_blocks) {
+		return EINVAL;
+	}
+
+	br->br_next = NULL;
+	br->br_merged = NULL;
+	br->br_passed = 0;
+
+	s = splhigh();
+	if (lh->lh_cur == NULL) {
+		/* Idle; start right away */
+		assert(lh->lh_queue == NULL);
+		lh->lh_cur = br;
+		lh->lh_cursect = 0;
+		lhd_startsect(lh);
+	}
+	else if (!lhd_merge(lh, br)) {
+		for (pp = &lh->lh_queue; *pp != NULL; pp = &(*pp)->br_next);
+		*pp = br;
+	}
+	splx(s);
+
+	return 0;
+}
+
+/*
+ * Completion function for lhd_rw.
+ */
+static
+void
+lhd_syncdone(struct bioreq *br)
+{
+	volatile int *done = br->br_arg;
+
+	*done = 1;
+	thread_wakeup(br);
+}
+
+/*
+ * Do one request and wait for it.
+ */
+static
+int
+lhd_rw(struct lhd_softc *lh, u_int32_t sector, u_int32_t nsect,
+       void *data, int iswrite)
+{
+	struct bioreq br;
+	volatile int done = 0;
+	int s, result;
+
+	br.br_block = sector;
+	br.br_nblocks = nsect;
+	br.br_write = iswrite;
+	br.br_data = data;
+	br.br_done = lhd_syncdone;
+	br.br_arg = (void *)&done;
+
+	result = lhd_submit(&lh->lh_dev, &br);
+	if (result) {
+		return result;
+	}
+
+	s = splhigh();
+	while (!done) {
+		thread_sleep(&br);
+	}
+	splx(s);
+
+	return br.br_result;
+}
+
 /*
  * I/O function (for both reads and writes)
+ *
+ * The data goes in requests of up to LHD_BATCH sectors so that one
+ * huge transfer doesn't shut everyone else out. A kernel buffer is
+ * handed to the hardware as is; user data has to go through a bounce
+ * buffer, since the interrupt handler can't get at user memory.
  */
 static
 int
@@ -177,9 +427,10 @@ lhd_io(struct device *d, struct uio *uio)
 	u_int32_t sectoff = uio->uio_offset % LHD_SECTSIZE;
 	u_int32_t len = uio->uio_resid / LHD_SECTSIZE;
 	u_int32_t lenoff = uio->uio_resid % LHD_SECTSIZE;
-	u_int32_t i;
-	u_int32_t statval = LHD_WORKING;
-	int result;
+	u_int32_t i, n;
+	int iswrite = (uio->uio_rw == UIO_WRITE);
+	char *buf;
+	int result = 0;
 
 	/* Don't allow I/O that isn't sector-aligned. */
 	if (sectoff != 0 || lenoff != 0) {
@@ -191,59 +442,56 @@ lhd_io(struct device *d, struct uio *uio)
 		return EINVAL;
 	}
 
-	/* Set up the value to write into the status register. */
-	if (uio->uio_rw==UIO_WRITE) {
-		statval |= LHD_ISWRITE;
+	if (len == 0) {
+		return 0;
 	}
 
-	/* Loop over all the sectors we were asked to do. */
-	for (i=0; i<len; i++) {
-
-		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
-
-		/*
-		 * Are we writing? If so, transfer the data to the
-		 * on-card buffer.
-		 */
-		if (uio->uio_rw == UIO_WRITE) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
-			if (result) {
-				V(lh->lh_clear);
-				return result;
+	if (uio->uio_segflg == UIO_SYSSPACE) {
+		buf = uio->uio_iovec.iov_kbase;
+		for (i=0; i<len && result==0; i+=n) {
+			n = len - i;
+			if (n > LHD_BATCH) {
+				n = LHD_BATCH;
 			}
+			result = lhd_rw(lh, sector+i, n,
+					buf + i*LHD_SECTSIZE, iswrite);
 		}
+		if (result == 0) {
+			uio->uio_iovec.iov_kbase = buf + len*LHD_SECTSIZE;
+			uio->uio_iovec.iov_len -= len*LHD_SECTSIZE;
+			uio->uio_resid -= len*LHD_SECTSIZE;
+			uio->uio_offset += len*LHD_SECTSIZE;
+		}
+		return result;
+	}
 
-		/* Tell it what sector we want... */
-		lhd_wreg(lh, LHD_REG_SECT, sector+i);
-
-		/* and start the operation. */
-		lhd_wreg(lh, LHD_REG_STAT, statval);
-
-		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+	buf = kmalloc((len < LHD_BATCH ? len : LHD_BATCH) * LHD_SECTSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
 
-		/* Get the result value saved by the interrupt handler. */
-		result = lh->lh_result;
+	for (i=0; i<len && result==0; i+=n) {
+		n = len - i;
+		if (n > LHD_BATCH) {
+			n = LHD_BATCH;
+		}
 
-		/*
-		 * Are we reading? If so, and if we succeeded,
-		 * transfer the data out of the on-card buffer.
-		 */
-		if (result==0 && uio->uio_rw==UIO_READ) {
-			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
+		if (iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
+			if (result) {
+				break;
+			}
 		}
 
-		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+		result = lhd_rw(lh, sector+i, n, buf, iswrite);
 
-		/* If we failed, return the error. */
-		if (result) {
-			return result;
+		if (result == 0 && !iswrite) {
+			result = uiomove(buf, n*LHD_SECTSIZE, uio);
 		}
 	}
 
-	return 0;
+	kfree(buf);
+	return result;
 }
 
 /*
@@ -260,23 +508,18 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Nothing queued yet. */
+	lh->lh_queue = NULL;
+	lh->lh_cur = NULL;
+	lh->lh_cursect = 0;
+	lh->lh_headpos = 0;
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_submit = lhd_submit;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
@@ -22,9 +22,15 @@ struct lhd_softc {
 	 */
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
-	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+
+	/*
+	 * Request queue; see lhd.c. Touched by the interrupt handler,
+	 * so only with interrupts off.
+	 */
+	struct bioreq *lh_queue;	/* waiting, oldest first */
+	struct bioreq *lh_cur;		/* being done now, or NULL */
+	u_int32_t lh_cursect;		/* sectors of lh_cur done so far */
+	u_int32_t lh_headpos;		/* last sector transferred */
 
 	struct device lh_dev;		/* VFS device structure */
 };
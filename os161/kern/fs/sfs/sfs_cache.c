@@ -0,0 +1,905 @@
+/*
+ * SFS filesystem
+ *
+ * Block buffer cache.
+ *
+ * Every block SFS reads or writes goes through here. Cached blocks
+ * are found through a hash on (device, block number); buffers that
+ * nobody is holding also sit on an LRU list, least recently released
+ * first, and that is where a buffer is taken from when a new block
+ * needs one and the cache is already full.
+ *
+ * Writes are delayed. A modified buffer goes on the dirty list, oldest
+ * first, and is written back later by one of:
+ *
+ *    - the flusher thread, which wakes once a second and writes back
+ *      anything dirty for SFS_DIRTYAGE seconds or more, or everything
+ *      it can while more than SFS_DIRTYBG buffers are dirty;
+ *    - a thread releasing a buffer when more than SFS_DIRTYMAX are
+ *      dirty, which writes back old buffers itself until the count is
+ *      down again, so that writers are held to the speed of the disk
+ *      once the cache is full of dirty data;
+ *    - a thread that needs a buffer when every idle one is dirty;
+ *    - sfs_bflush and sfs_bflushblock, for sync and fsync.
+ *
+ * Whoever writes a dirty buffer back also picks up any idle dirty
+ * buffers for the blocks on either side of it, up to SFS_MAXRUN in
+ * all, and writes the lot with one transfer.
+ *
+ * Reads can also be started early with sfs_bprefetch, which queues the
+ * block for the read-ahead thread and returns at once. That thread
+ * reads runs of consecutive queued blocks with one transfer each, as
+ * sfs_bfill does for callers that want a run of blocks right away.
+ *
+ * bc_lock protects all of the bookkeeping. The contents of a buffer
+ * belong to whichever thread has it busy, so bc_lock is never held
+ * across disk I/O.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <clock.h>
+#include <uio.h>
+#include <dev.h>
+#include <sfs.h>
+
+/* Most buffers we will ever allocate */
+#ifndef SFS_NBUF
+#define SFS_NBUF     128
+#endif
+
+/* Number of hash chains; prime so block numbers spread out */
+#define SFS_BHASHSIZE 61
+
+/* Write-back policy; see above */
+#define SFS_DIRTYAGE  2			/* seconds */
+#define SFS_DIRTYBG   (SFS_NBUF/2)
+#define SFS_DIRTYMAX  (SFS_NBUF*3/4)
+
+/* Most blocks written back, or read in, with one transfer */
+#define SFS_MAXRUN    32
+
+/* Read-ahead requests that can be waiting; more are dropped */
+#define SFS_RAQUEUE   64
+
+static struct lock *bc_lock;
+static struct cv *bc_cv;			/* buffer released */
+
+static struct sfs_buf *bc_hash[SFS_BHASHSIZE];
+static struct sfs_buf *bc_lruhead;		/* next to recycle */
+static struct sfs_buf *bc_lrutail;
+static struct sfs_buf *bc_dirtyhead;		/* oldest dirty buffer */
+static struct sfs_buf *bc_dirtytail;
+static int bc_nbufs;
+static int bc_ndirty;
+
+static u_int32_t bc_hits, bc_misses, bc_evictions;
+static u_int32_t bc_flushes, bc_flushblocks;
+
+/* Read-ahead queue, also under bc_lock */
+static struct {
+	struct sfs_fs *ra_fs;
+	u_int32_t ra_block;
+} ra_queue[SFS_RAQUEUE];
+static int ra_head, ra_count;
+static struct cv *ra_cv;			/* queue not empty */
+static struct sfs_fs *ra_busyfs;		/* being read ahead now */
+static u_int32_t ra_reads, ra_blocks, ra_dropped;
+
+static
+unsigned
+bhash(struct device *dev, u_int32_t block)
+{
+	return (((u_int32_t)dev >> 4) + block) % SFS_BHASHSIZE;
+}
+
+static
+void
+lru_remove(struct sfs_buf *b)
+{
+	if (b->b_lruprev != NULL) {
+		b->b_lruprev->b_lrunext = b->b_lrunext;
+	}
+	else {
+		assert(bc_lruhead == b);
+		bc_lruhead = b->b_lrunext;
+	}
+	if (b->b_lrunext != NULL) {
+		b->b_lrunext->b_lruprev = b->b_lruprev;
+	}
+	else {
+		assert(bc_lrutail == b);
+		bc_lrutail = b->b_lruprev;
+	}
+	b->b_lruprev = b->b_lrunext = NULL;
+}
+
+static
+void
+lru_append(struct sfs_buf *b)
+{
+	b->b_lruprev = bc_lrutail;
+	b->b_lrunext = NULL;
+	if (bc_lrutail != NULL) {
+		bc_lrutail->b_lrunext = b;
+	}
+	else {
+		bc_lruhead = b;
+	}
+	bc_lrutail = b;
+}
+
+static
+void
+hash_remove(struct sfs_buf *b)
+{
+	struct sfs_buf **pp;
+
+	for (pp = &bc_hash[bhash(b->b_dev, b->b_block)]; *pp != NULL;
+	     pp = &(*pp)->b_hashnext) {
+		if (*pp == b) {
+			*pp = b->b_hashnext;
+			b->b_hashnext = NULL;
+			return;
+		}
+	}
+	panic("sfs: buffer for block %u not in hash\n", b->b_block);
+}
+
+static
+struct sfs_buf *
+hash_find(struct device *dev, u_int32_t block)
+{
+	struct sfs_buf *b;
+
+	for (b = bc_hash[bhash(dev, block)]; b != NULL; b = b->b_hashnext) {
+		if (b->b_dev == dev && b->b_block == block) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+dirty_remove(struct sfs_buf *b)
+{
+	if (b->b_dirtyprev != NULL) {
+		b->b_dirtyprev->b_dirtynext = b->b_dirtynext;
+	}
+	else {
+		assert(bc_dirtyhead == b);
+		bc_dirtyhead = b->b_dirtynext;
+	}
+	if (b->b_dirtynext != NULL) {
+		b->b_dirtynext->b_dirtyprev = b->b_dirtyprev;
+	}
+	else {
+		assert(bc_dirtytail == b);
+		bc_dirtytail = b->b_dirtyprev;
+	}
+	b->b_dirtyprev = b->b_dirtynext = NULL;
+}
+
+static
+void
+dirty_append(struct sfs_buf *b)
+{
+	b->b_dirtyprev = bc_dirtytail;
+	b->b_dirtynext = NULL;
+	if (bc_dirtytail != NULL) {
+		bc_dirtytail->b_dirtynext = b;
+	}
+	else {
+		bc_dirtyhead = b;
+	}
+	bc_dirtytail = b;
+}
+
+/*
+ * Mark a buffer as matching the disk again.
+ */
+static
+void
+buf_clean(struct sfs_buf *b)
+{
+	if (b->b_dirty) {
+		b->b_dirty = 0;
+		dirty_remove(b);
+		bc_ndirty--;
+	}
+}
+
+/*
+ * Find the oldest dirty buffer nobody is using, or NULL.
+ */
+static
+struct sfs_buf *
+buf_oldestidle(void)
+{
+	struct sfs_buf *b;
+
+	for (b = bc_dirtyhead; b != NULL; b = b->b_dirtynext) {
+		if (b->b_refcount == 0) {
+			return b;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * True if B can be written back along with a neighbour.
+ */
+static
+int
+buf_canflush(struct sfs_buf *b)
+{
+	return b != NULL && b->b_dirty && b->b_refcount == 0;
+}
+
+/*
+ * Write N busy buffers for consecutive blocks with one transfer.
+ * If we can't get memory to gather them into, write them one by one.
+ */
+static
+int
+run_write(struct sfs_buf **run, int n)
+{
+	struct sfs_fs *sfs = run[0]->b_fs;
+	struct uio ku;
+	char *data;
+	int i, result;
+
+	data = NULL;
+	if (n > 1) {
+		data = kmalloc(n*SFS_BLOCKSIZE);
+	}
+
+	if (data == NULL) {
+		for (i=0; i<n; i++) {
+			SFSUIO(&ku, run[i]->b_data, run[i]->b_block, UIO_WRITE);
+			result = sfs_rwblock(sfs, &ku);
+			if (result) {
+				return result;
+			}
+		}
+		return 0;
+	}
+
+	for (i=0; i<n; i++) {
+		assert(run[i]->b_block == run[0]->b_block + i);
+		memcpy(data + i*SFS_BLOCKSIZE, run[i]->b_data, SFS_BLOCKSIZE);
+	}
+	mk_kuio(&ku, data, n*SFS_BLOCKSIZE,
+		((off_t)run[0]->b_block)*SFS_BLOCKSIZE, UIO_WRITE);
+	result = sfs_rwblock(sfs, &ku);
+	kfree(data);
+	return result;
+}
+
+/*
+ * Write back B, which must be dirty and idle, together with the idle
+ * dirty buffers for the blocks around it. Called with bc_lock held;
+ * drops it during the I/O. If the write fails the buffers stay dirty.
+ */
+static
+int
+buf_flushrun(struct sfs_buf *b)
+{
+	struct sfs_buf *run[SFS_MAXRUN];
+	struct device *dev = b->b_dev;
+	u_int32_t start;
+	int i, n, result;
+
+	assert(lock_do_i_hold(bc_lock));
+	assert(buf_canflush(b));
+
+	/* Back up over dirty blocks before B... */
+	start = b->b_block;
+	n = 1;
+	while (n < SFS_MAXRUN && start > 0 &&
+	       buf_canflush(hash_find(dev, start-1))) {
+		start--;
+		n++;
+	}
+
+	/* ...then collect forward from there. */
+	for (i=0; i<SFS_MAXRUN; i++) {
+		struct sfs_buf *nb = hash_find(dev, start+i);
+		if (!buf_canflush(nb)) {
+			break;
+		}
+		run[i] = nb;
+	}
+	n = i;
+	assert(n >= 1);
+
+	for (i=0; i<n; i++) {
+		lru_remove(run[i]);
+		run[i]->b_refcount++;
+		run[i]->b_busy = 1;
+	}
+
+	lock_release(bc_lock);
+	result = run_write(run, n);
+	lock_acquire(bc_lock);
+
+	for (i=0; i<n; i++) {
+		if (result == 0) {
+			buf_clean(run[i]);
+		}
+		run[i]->b_busy = 0;
+		run[i]->b_refcount--;
+		if (run[i]->b_refcount == 0) {
+			lru_append(run[i]);
+		}
+	}
+	bc_flushes++;
+	bc_flushblocks += n;
+	cv_broadcast(bc_cv, bc_lock);
+
+	return result;
+}
+
+/*
+ * Come up with a buffer that isn't caching anything: a new one if we
+ * are still under SFS_NBUF, otherwise the least recently used clean
+ * one. Returns NULL if there isn't one; the caller should write back
+ * a dirty buffer, or wait on bc_cv if there are none, and look again.
+ */
+static
+struct sfs_buf *
+buf_getfree(void)
+{
+	struct sfs_buf *b;
+
+	assert(lock_do_i_hold(bc_lock));
+
+	if (bc_nbufs < SFS_NBUF) {
+		b = kmalloc(sizeof(struct sfs_buf));
+		if (b != NULL) {
+			b->b_data = kmalloc(SFS_BLOCKSIZE);
+			if (b->b_data == NULL) {
+				kfree(b);
+				b = NULL;
+			}
+		}
+		if (b != NULL) {
+			bc_nbufs++;
+			b->b_dirty = 0;
+			b->b_hashnext = NULL;
+			b->b_lruprev = b->b_lrunext = NULL;
+			b->b_dirtyprev = b->b_dirtynext = NULL;
+			return b;
+		}
+		/* Out of memory; fall back to recycling */
+	}
+
+	for (b = bc_lruhead; b != NULL && b->b_dirty; b = b->b_lrunext);
+	if (b == NULL) {
+		return NULL;
+	}
+	assert(b->b_refcount == 0 && !b->b_busy);
+	lru_remove(b);
+	hash_remove(b);
+	bc_evictions++;
+	return b;
+}
+
+/*
+ * Find or make the buffer for BLOCK on the filesystem's device and
+ * make it busy on behalf of the caller. Fails if we had to write back
+ * a dirty buffer to make room and couldn't, or, if NOWAIT is set,
+ * with EAGAIN instead of waiting for another thread to let go of a
+ * buffer. Callers already holding busy buffers must use NOWAIT, or
+ * enough of them could hold the whole cache and wait on each other.
+ */
+static
+int
+buf_acquire(struct sfs_fs *sfs, u_int32_t block, int nowait,
+	    struct sfs_buf **ret)
+{
+	struct device *dev = sfs->sfs_device;
+	struct sfs_buf *b;
+	int result;
+
+	lock_acquire(bc_lock);
+
+	while ((b = hash_find(dev, block)) == NULL) {
+		b = buf_getfree();
+		if (b != NULL) {
+			b->b_fs = sfs;
+			b->b_dev = dev;
+			b->b_block = block;
+			b->b_valid = 0;
+			b->b_busy = 0;
+			b->b_refcount = 0;
+			b->b_hashnext = bc_hash[bhash(dev, block)];
+			bc_hash[bhash(dev, block)] = b;
+			break;
+		}
+
+		b = buf_oldestidle();
+		if (b == NULL) {
+			if (nowait) {
+				lock_release(bc_lock);
+				return EAGAIN;
+			}
+			cv_wait(bc_cv, bc_lock);
+			continue;
+		}
+		result = buf_flushrun(b);
+		if (result) {
+			lock_release(bc_lock);
+			return result;
+		}
+	}
+
+	if (b->b_busy && nowait) {
+		lock_release(bc_lock);
+		return EAGAIN;
+	}
+
+	if (b->b_refcount == 0) {
+		/* Idle buffers (except brand new ones) are on the LRU list */
+		if (b->b_lruprev != NULL || bc_lruhead == b) {
+			lru_remove(b);
+		}
+	}
+	b->b_refcount++;
+
+	while (b->b_busy) {
+		cv_wait(bc_cv, bc_lock);
+	}
+	b->b_busy = 1;
+
+	/* We may be a filesystem mounted on a device some older one used */
+	b->b_fs = sfs;
+
+	lock_release(bc_lock);
+	*ret = b;
+	return 0;
+}
+
+/*
+ * Transfer a buffer's block to or from disk.
+ */
+static
+int
+buf_io(struct sfs_buf *b, enum uio_rw rw)
+{
+	struct uio ku;
+
+	assert(b->b_busy);
+	SFSUIO(&ku, b->b_data, b->b_block, rw);
+	return sfs_rwblock(b->b_fs, &ku);
+}
+
+/*
+ * Flusher thread.
+ */
+static
+void
+sfs_flusher(void *unused1, unsigned long unused2)
+{
+	struct sfs_buf *b;
+	time_t now;
+	u_int32_t nsecs;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		clocksleep(1);
+
+		lock_acquire(bc_lock);
+		gettime(&now, &nsecs);
+		while ((b = buf_oldestidle()) != NULL) {
+			if (bc_ndirty <= SFS_DIRTYBG &&
+			    now - b->b_dirtysecs < SFS_DIRTYAGE) {
+				break;
+			}
+			if (buf_flushrun(b)) {
+				/* Leave it; try again next time around */
+				break;
+			}
+		}
+		lock_release(bc_lock);
+	}
+}
+
+/*
+ * Read N consecutive blocks into the busy, invalid buffers RUN with
+ * one transfer, and release them.
+ */
+static
+void
+run_read(struct sfs_buf **run, int n)
+{
+	struct uio ku;
+	char *data;
+	int i, result;
+
+	data = NULL;
+	if (n > 1) {
+		data = kmalloc(n*SFS_BLOCKSIZE);
+	}
+
+	if (data == NULL) {
+		for (i=0; i<n; i++) {
+			if (buf_io(run[i], UIO_READ) == 0) {
+				run[i]->b_valid = 1;
+			}
+		}
+	}
+	else {
+		mk_kuio(&ku, data, n*SFS_BLOCKSIZE,
+			((off_t)run[0]->b_block)*SFS_BLOCKSIZE, UIO_READ);
+		result = sfs_rwblock(run[0]->b_fs, &ku);
+		for (i=0; i<n; i++) {
+			if (result == 0) {
+				memcpy(run[i]->b_data,
+				       data + i*SFS_BLOCKSIZE, SFS_BLOCKSIZE);
+				run[i]->b_valid = 1;
+			}
+		}
+		kfree(data);
+	}
+
+	for (i=0; i<n; i++) {
+		sfs_brelse(run[i]);
+	}
+
+	ra_reads++;
+	ra_blocks += n;
+}
+
+/*
+ * Make sure the N blocks from START are in the cache, reading each
+ * stretch of them that isn't with one transfer. While we hold part
+ * of a run we never wait for a buffer; if none is to be had, the run
+ * so far is read (which releases it) and we wait empty-handed.
+ */
+static
+void
+buf_fillrun(struct sfs_fs *sfs, u_int32_t start, u_int32_t n)
+{
+	struct sfs_buf *run[SFS_MAXRUN];
+	struct sfs_buf *b;
+	u_int32_t i;
+	int got, result;
+
+	got = 0;
+	for (i=0; i<n; i++) {
+		if (got == SFS_MAXRUN) {
+			run_read(run, got);
+			got = 0;
+		}
+		result = buf_acquire(sfs, start+i, got > 0, &b);
+		if (result == EAGAIN) {
+			run_read(run, got);
+			got = 0;
+			result = buf_acquire(sfs, start+i, 0, &b);
+		}
+		if (result) {
+			break;
+		}
+		if (b->b_valid) {
+			sfs_brelse(b);
+			if (got > 0) {
+				run_read(run, got);
+				got = 0;
+			}
+			continue;
+		}
+		run[got++] = b;
+	}
+	if (got > 0) {
+		run_read(run, got);
+	}
+}
+
+/*
+ * Prefetch (read-ahead) thread.
+ */
+static
+void
+sfs_prefetcher(void *unused1, unsigned long unused2)
+{
+	struct sfs_fs *sfs;
+	u_int32_t start;
+	int n;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		lock_acquire(bc_lock);
+		while (ra_count == 0) {
+			cv_wait(ra_cv, bc_lock);
+		}
+
+		/* Take as many consecutive blocks as we can */
+		sfs = ra_queue[ra_head].ra_fs;
+		start = ra_queue[ra_head].ra_block;
+		n = 0;
+		while (ra_count > 0 && n < SFS_MAXRUN &&
+		       ra_queue[ra_head].ra_fs == sfs &&
+		       ra_queue[ra_head].ra_block == start + n) {
+			ra_head = (ra_head + 1) % SFS_RAQUEUE;
+			ra_count--;
+			n++;
+		}
+		ra_busyfs = sfs;
+		lock_release(bc_lock);
+
+		buf_fillrun(sfs, start, n);
+
+		lock_acquire(bc_lock);
+		ra_busyfs = NULL;
+		cv_broadcast(bc_cv, bc_lock);
+		lock_release(bc_lock);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+void
+sfs_bootstrap(void)
+{
+	int i;
+
+	bc_lock = lock_create("sfs bcache");
+	bc_cv = cv_create("sfs bcache");
+	ra_cv = cv_create("sfs prefetch");
+	if (bc_lock == NULL || bc_cv == NULL || ra_cv == NULL) {
+		panic("sfs: Could not create buffer cache\n");
+	}
+	for (i=0; i<SFS_BHASHSIZE; i++) {
+		bc_hash[i] = NULL;
+	}
+	bc_lruhead = bc_lrutail = NULL;
+	bc_dirtyhead = bc_dirtytail = NULL;
+	bc_nbufs = 0;
+	bc_ndirty = 0;
+	ra_head = ra_count = 0;
+	ra_busyfs = NULL;
+
+	if (thread_fork("sfs flusher", NULL, 0, sfs_flusher, NULL)) {
+		panic("sfs: Could not start flusher thread\n");
+	}
+	if (thread_fork("sfs prefetch", NULL, 0, sfs_prefetcher, NULL)) {
+		panic("sfs: Could not start read-ahead thread\n");
+	}
+}
+
+int
+sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	struct sfs_buf *b;
+	int result;
+
+	result = buf_acquire(sfs, block, 0, &b);
+	if (result) {
+		return result;
+	}
+	if (b->b_valid) {
+		bc_hits++;
+	}
+	else {
+		bc_misses++;
+		result = buf_io(b, UIO_READ);
+		if (result) {
+			sfs_brelse(b);
+			return result;
+		}
+		b->b_valid = 1;
+	}
+
+	*ret = b;
+	return 0;
+}
+
+void
+sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+	int i;
+
+	lock_acquire(bc_lock);
+
+	b = hash_find(sfs->sfs_device, block);
+	if (b != NULL && (b->b_valid || b->b_busy)) {
+		/* Already there, or on its way */
+	}
+	else if (ra_count == SFS_RAQUEUE) {
+		ra_dropped++;
+	}
+	else {
+		i = (ra_head + ra_count) % SFS_RAQUEUE;
+		ra_queue[i].ra_fs = sfs;
+		ra_queue[i].ra_block = block;
+		ra_count++;
+		cv_signal(ra_cv, bc_lock);
+	}
+
+	lock_release(bc_lock);
+}
+
+void
+sfs_bfill(struct sfs_fs *sfs, u_int32_t block, u_int32_t n)
+{
+	buf_fillrun(sfs, block, n);
+}
+
+int
+sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret)
+{
+	return buf_acquire(sfs, block, 0, ret);
+}
+
+void
+sfs_bdirty(struct sfs_buf *b)
+{
+	time_t secs;
+	u_int32_t nsecs;
+
+	assert(b->b_busy);
+
+	/* Whatever is in the buffer now is the current contents */
+	b->b_valid = 1;
+
+	lock_acquire(bc_lock);
+	if (!b->b_dirty) {
+		gettime(&secs, &nsecs);
+		b->b_dirty = 1;
+		b->b_dirtysecs = secs;
+		dirty_append(b);
+		bc_ndirty++;
+	}
+	lock_release(bc_lock);
+}
+
+void
+sfs_brelse(struct sfs_buf *b)
+{
+	lock_acquire(bc_lock);
+
+	assert(b->b_busy);
+	assert(b->b_refcount > 0);
+	b->b_busy = 0;
+	b->b_refcount--;
+
+	if (b->b_refcount == 0) {
+		lru_append(b);
+	}
+	cv_broadcast(bc_cv, bc_lock);
+
+	/* Too much dirty data; do some write-back ourselves */
+	while (bc_ndirty > SFS_DIRTYMAX && (b = buf_oldestidle()) != NULL) {
+		if (buf_flushrun(b)) {
+			break;
+		}
+	}
+
+	lock_release(bc_lock);
+}
+
+int
+sfs_bflushblock(struct sfs_fs *sfs, u_int32_t block)
+{
+	struct sfs_buf *b;
+	int result = 0;
+
+	lock_acquire(bc_lock);
+	while ((b = hash_find(sfs->sfs_device, block)) != NULL && b->b_dirty) {
+		if (b->b_refcount > 0) {
+			cv_wait(bc_cv, bc_lock);
+			continue;
+		}
+		result = buf_flushrun(b);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(bc_lock);
+	return result;
+}
+
+int
+sfs_bflush(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b;
+	int busy, result = 0;
+
+	lock_acquire(bc_lock);
+	while (1) {
+		busy = 0;
+		for (b = bc_dirtyhead; b != NULL; b = b->b_dirtynext) {
+			if (b->b_dev != sfs->sfs_device) {
+				continue;
+			}
+			if (b->b_refcount == 0) {
+				break;
+			}
+			busy = 1;
+		}
+
+		if (b != NULL) {
+			result = buf_flushrun(b);
+			if (result) {
+				break;
+			}
+		}
+		else if (busy) {
+			/* Wait for somebody to finish with one */
+			cv_wait(bc_cv, bc_lock);
+		}
+		else {
+			break;
+		}
+	}
+	lock_release(bc_lock);
+	return result;
+}
+
+void
+sfs_binval(struct sfs_fs *sfs)
+{
+	struct sfs_buf *b, **pp;
+	int i, n;
+
+	lock_acquire(bc_lock);
+
+	/* Cancel queued read-ahead and wait out any in progress */
+	n = ra_count;
+	ra_count = 0;
+	for (i=0; i<n; i++) {
+		int from = (ra_head + i) % SFS_RAQUEUE;
+		if (ra_queue[from].ra_fs != sfs) {
+			ra_queue[(ra_head + ra_count) % SFS_RAQUEUE] =
+				ra_queue[from];
+			ra_count++;
+		}
+	}
+	while (ra_busyfs == sfs) {
+		cv_wait(bc_cv, bc_lock);
+	}
+
+	for (i=0; i<SFS_BHASHSIZE; i++) {
+		pp = &bc_hash[i];
+		while ((b = *pp) != NULL) {
+			if (b->b_dev != sfs->sfs_device) {
+				pp = &b->b_hashnext;
+				continue;
+			}
+			/* Nobody may still be using the filesystem */
+			assert(b->b_refcount == 0);
+			assert(!b->b_dirty);
+			*pp = b->b_hashnext;
+			lru_remove(b);
+			kfree(b->b_data);
+			kfree(b);
+			bc_nbufs--;
+		}
+	}
+
+	lock_release(bc_lock);
+}
+
+void
+sfs_bstats(void)
+{
+	lock_acquire(bc_lock);
+	kprintf("sfs buffer cache: %d/%d buffers\n", bc_nbufs, SFS_NBUF);
+	kprintf("    %u hits, %u misses, %u evictions\n",
+		bc_hits, bc_misses, bc_evictions);
+	kprintf("    %d dirty, %u blocks written back in %u transfers\n",
+		bc_ndirty, bc_flushblocks, bc_flushes);
+	kprintf("    %u blocks read ahead in %u transfers, %u dropped\n",
+		ra_blocks, ra_reads, ra_dropped);
+	lock_release(bc_lock);
+}
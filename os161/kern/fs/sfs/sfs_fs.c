@@ -7,7 +7,6 @@
 #include <types.h>
 #include <lib.h>
 #include <kern/errno.h>
-#include <array.h>
 #include <bitmap.h>
 #include <uio.h>
 #include <dev.h>
@@ -82,7 +81,8 @@ int
 sfs_sync(struct fs *fs)
 {
 	struct sfs_fs *sfs; 
-	int i, num, result;
+	struct sfs_vnode *sv;
+	int i, n, result;
 
 	/*
 	 * Get the sfs_fs from the generic abstract fs.
@@ -116,11 +116,26 @@ sfs_sync(struct fs *fs)
 
 	sfs = fs->fs_data;
 
-	/* Go over the array of loaded vnodes, syncing as we go. */
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv = array_getguy(sfs->sfs_vnodes, i);
-		VOP_FSYNC(&sv->sv_v);
+	/*
+	 * Go over the loaded vnodes whose inodes have changed, syncing
+	 * as we go. Data blocks of the others are written out by
+	 * sfs_bflush below.
+	 *
+	 * Syncing takes a vnode off the list, but it sleeps on disk I/O,
+	 * and meanwhile other vnodes can be cleaned or reclaimed. So
+	 * don't keep a pointer into the list; start from the head each
+	 * time, holding a reference to the vnode being synced. Stop after
+	 * as many as are loaded, so that files being written the whole
+	 * time can't keep us here forever.
+	 */
+	n = sfs->sfs_nvnodes;
+	for (i=0; i<n && (sv = sfs->sfs_dirtyvn) != NULL; i++) {
+		VOP_INCREF(&sv->sv_v);
+		result = VOP_FSYNC(&sv->sv_v);
+		VOP_DECREF(&sv->sv_v);
+		if (result) {
+			return result;
+		}
 	}
 
 	/* If the free block map needs to be written, write it. */
@@ -141,7 +156,8 @@ sfs_sync(struct fs *fs)
 		sfs->sfs_superdirty = 0;
 	}
 
-	return 0;
+	/* All of the above only went to the cache; now write it all out */
+	return sfs_bflush(sfs);
 }
 
 /*
@@ -169,7 +185,7 @@ sfs_unmount(struct fs *fs)
 	struct sfs_fs *sfs = fs->fs_data;
 	
 	/* Do we have any files open? If so, can't unmount. */
-	if (array_getnum(sfs->sfs_vnodes)>0) {
+	if (sfs->sfs_nvnodes>0) {
 		return EBUSY;
 	}
 
@@ -178,7 +194,7 @@ sfs_unmount(struct fs *fs)
 	assert(sfs->sfs_freemapdirty==0);
 
 	/* Once we start nuking stuff we can't fail. */
-	array_destroy(sfs->sfs_vnodes);
+	sfs_binval(sfs);
 	bitmap_destroy(sfs->sfs_freemap);
 	
 	/* The vfs layer takes care of the device for us */
@@ -209,7 +225,7 @@ static
 int
 sfs_domount(void *options, struct device *dev, struct fs **ret)
 {
-	int result;
+	int i, result;
 	struct sfs_fs *sfs;
 
 	/* We don't pass any options through mount */
@@ -240,12 +256,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 		return ENOMEM;
 	}
 
-	/* Allocate array */
-	sfs->sfs_vnodes = array_create();
-	if (sfs->sfs_vnodes == NULL) {
-		kfree(sfs);
-		return ENOMEM;
+	/* No vnodes loaded yet */
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		sfs->sfs_vnhash[i] = NULL;
 	}
+	sfs->sfs_nvnodes = 0;
+	sfs->sfs_dirtyvn = NULL;
+	sfs->sfs_vnlookups = 0;
+	sfs->sfs_vnprobes = 0;
 
 	/* Set the device so we can use sfs_rblock() */
 	sfs->sfs_device = dev;
@@ -253,7 +271,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load superblock */
 	result = sfs_rblock(sfs, &sfs->sfs_super, SFS_SB_LOCATION);
 	if (result) {
-		array_destroy(sfs->sfs_vnodes);
+		sfs_binval(sfs);
 		kfree(sfs);
 		return result;
 	}
@@ -265,7 +283,22 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 			"(0x%x, should be 0x%x)\n", 
 			sfs->sfs_super.sp_magic,
 			SFS_MAGIC);
-		array_destroy(sfs->sfs_vnodes);
+		sfs_binval(sfs);
+		kfree(sfs);
+		return EINVAL;
+	}
+
+	/*
+	 * Version 0 filesystems predate the double and triple indirect
+	 * blocks, but those fields were always zero, so they mount as is.
+	 * sfs_bmap raises the version the first time a file on one grows
+	 * into them.
+	 */
+	if (sfs->sfs_super.sp_version > SFS_VERSION) {
+		kprintf("sfs: Unknown filesystem version %u "
+			"(this kernel supports up to %u)\n",
+			sfs->sfs_super.sp_version, SFS_VERSION);
+		sfs_binval(sfs);
 		kfree(sfs);
 		return EINVAL;
 	}
@@ -281,14 +314,14 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* Load free space bitmap */
 	sfs->sfs_freemap = bitmap_create(SFS_FS_BITMAPSIZE(sfs));
 	if (sfs->sfs_freemap == NULL) {
-		array_destroy(sfs->sfs_vnodes);
+		sfs_binval(sfs);
 		kfree(sfs);
 		return ENOMEM;
 	}
 	result = sfs_mapio(sfs, UIO_READ);
 	if (result) {
 		bitmap_destroy(sfs->sfs_freemap);
-		array_destroy(sfs->sfs_vnodes);
+		sfs_binval(sfs);
 		kfree(sfs);
 		return result;
 	}
@@ -303,6 +336,7 @@ sfs_domount(void *options, struct device *dev, struct fs **ret)
 	/* the other fields */
 	sfs->sfs_superdirty = 0;
 	sfs->sfs_freemapdirty = 0;
+	sfs->sfs_allochint = 0;
 
 	/* Hand back the abstract fs */
 	*ret = &sfs->sfs_absfs;
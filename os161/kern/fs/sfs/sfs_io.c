@@ -9,10 +9,14 @@
 //
 // Basic block-level I/O routines
 //
+// sfs_wblock only dirties the block in the buffer cache;
+// use sfs_bflush or sfs_bflushblock to be sure it's on disk.
+//
 // Note: sfs_rblock is used to read the superblock
 // early in mount, before sfs is fully (or even mostly)
 // initialized, and so may not use anything from sfs
-// except sfs_device.
+// except sfs_device. (The buffer cache only looks at
+// sfs_device too.)
 
 int
 sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
@@ -57,15 +61,30 @@ sfs_rwblock(struct sfs_fs *sfs, struct uio *uio)
 int
 sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
-	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_READ);
-	return sfs_rwblock(sfs, &ku);
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bread(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(data, b->b_data, SFS_BLOCKSIZE);
+	sfs_brelse(b);
+	return 0;
 }
 
 int
 sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block)
 {
-	struct uio ku;
-	SFSUIO(&ku, data, block, UIO_WRITE);
-	return sfs_rwblock(sfs, &ku);
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bget(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	memcpy(b->b_data, data, SFS_BLOCKSIZE);
+	sfs_bdirty(b);
+	sfs_brelse(b);
+	return 0;
 }
@@ -6,12 +6,12 @@
 #include <types.h>
 #include <lib.h>
 #include <synch.h>
-#include <array.h>
 #include <bitmap.h>
 #include <kern/stat.h>
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <uio.h>
+#include <vfs.h>
 #include <dev.h>
 #include <sfs.h>
 
@@ -20,6 +20,125 @@ static int
 sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int type,
 		 struct sfs_vnode **ret);
 
+////////////////////////////////////////////////////////////
+//
+// Table of loaded vnodes
+
+/*
+ * Loaded vnodes are kept in a hash table in the sfs_fs, chained
+ * through sv_hashnext, so finding one by inode number doesn't mean
+ * looking at all of them. Those whose inode has been modified in
+ * memory are also on the sfs_dirtyvn list, so that sfs_sync needn't
+ * look at the rest.
+ *
+ * Like the rest of the per-filesystem state, none of this is locked.
+ */
+
+static
+unsigned
+sfs_vnhash(u_int32_t ino)
+{
+	return ino % SFS_VNHASHSIZE;
+}
+
+/*
+ * Find the loaded vnode for inode INO. Returns NULL if it isn't loaded.
+ */
+static
+struct sfs_vnode *
+sfs_vnfind(struct sfs_fs *sfs, u_int32_t ino)
+{
+	struct sfs_vnode *sv;
+
+	sfs->sfs_vnlookups++;
+	for (sv = sfs->sfs_vnhash[sfs_vnhash(ino)]; sv != NULL;
+	     sv = sv->sv_hashnext) {
+		sfs->sfs_vnprobes++;
+		if (sv->sv_ino == ino) {
+			return sv;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+sfs_vnadd(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	unsigned h = sfs_vnhash(sv->sv_ino);
+
+	sv->sv_hashnext = sfs->sfs_vnhash[h];
+	sfs->sfs_vnhash[h] = sv;
+	sfs->sfs_nvnodes++;
+}
+
+static
+void
+sfs_vnremove(struct sfs_fs *sfs, struct sfs_vnode *sv)
+{
+	struct sfs_vnode **p;
+
+	for (p = &sfs->sfs_vnhash[sfs_vnhash(sv->sv_ino)]; *p != NULL;
+	     p = &(*p)->sv_hashnext) {
+		if (*p == sv) {
+			*p = sv->sv_hashnext;
+			sv->sv_hashnext = NULL;
+			sfs->sfs_nvnodes--;
+			return;
+		}
+	}
+	panic("sfs: reclaim vnode %u not in vnode pool\n", sv->sv_ino);
+}
+
+/*
+ * Note that a vnode's inode has been changed in memory.
+ */
+static
+void
+sfs_vdirty(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	if (sv->sv_dirty) {
+		return;
+	}
+	sv->sv_dirty = 1;
+
+	sv->sv_dirtyprev = NULL;
+	sv->sv_dirtynext = sfs->sfs_dirtyvn;
+	if (sfs->sfs_dirtyvn != NULL) {
+		sfs->sfs_dirtyvn->sv_dirtyprev = sv;
+	}
+	sfs->sfs_dirtyvn = sv;
+}
+
+/*
+ * Note that a vnode's inode has been written back.
+ */
+static
+void
+sfs_vclean(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	if (!sv->sv_dirty) {
+		return;
+	}
+	sv->sv_dirty = 0;
+
+	if (sv->sv_dirtyprev != NULL) {
+		sv->sv_dirtyprev->sv_dirtynext = sv->sv_dirtynext;
+	}
+	else {
+		assert(sfs->sfs_dirtyvn == sv);
+		sfs->sfs_dirtyvn = sv->sv_dirtynext;
+	}
+	if (sv->sv_dirtynext != NULL) {
+		sv->sv_dirtynext->sv_dirtyprev = sv->sv_dirtyprev;
+	}
+	sv->sv_dirtyprev = sv->sv_dirtynext = NULL;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -29,12 +148,23 @@ static
 int
 sfs_clearblock(struct sfs_fs *sfs, u_int32_t block)
 {
-	/* static -> automatically initialized to zero */
-	static char zeros[SFS_BLOCKSIZE];
-	return sfs_wblock(sfs, zeros, block);
+	struct sfs_buf *b;
+	int result;
+
+	result = sfs_bget(sfs, block, &b);
+	if (result) {
+		return result;
+	}
+	bzero(b->b_data, SFS_BLOCKSIZE);
+	sfs_bdirty(b);
+	sfs_brelse(b);
+	return 0;
 }
 
-/* Write an on-disk inode structure back out to disk. */
+/*
+ * Write an on-disk inode structure back out to disk. (That is, to the
+ * buffer cache, which writes it to disk in due course.)
+ */
 static
 int
 sfs_sync_inode(struct sfs_vnode *sv)
@@ -45,7 +175,7 @@ sfs_sync_inode(struct sfs_vnode *sv)
 		if (result) {
 			return result;
 		}
-		sv->sv_dirty = 0;
+		sfs_vclean(sv);
 	}
 	return 0;
 }
@@ -55,15 +185,72 @@ sfs_sync_inode(struct sfs_vnode *sv)
 // Space allocation
 
 /*
- * Allocate a block.
+ * When a file allocates a data block somewhere other than where its
+ * reservation (if any) starts, the next SFS_PREALLOC-1 free blocks
+ * after it are reserved for the file as well, so that a file being
+ * appended to keeps getting consecutive blocks even while other files
+ * are being written. The reservation is marked in the freemap; it is
+ * given back on the file's last close, on truncate and on reclaim,
+ * and taken back from every file if the disk otherwise fills up.
+ */
+#define SFS_PREALLOC  8
+
+/*
+ * Give back whatever blocks are still reserved for a file.
+ */
+static
+void
+sfs_prefree(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+
+	while (sv->sv_npre > 0) {
+		bitmap_unmark(sfs->sfs_freemap, sv->sv_prestart);
+		sv->sv_prestart++;
+		sv->sv_npre--;
+		sfs->sfs_freemapdirty = 1;
+	}
+}
+
+/*
+ * Give back the reservations of every loaded file.
+ */
+static
+void
+sfs_prefreeall(struct sfs_fs *sfs)
+{
+	struct sfs_vnode *sv;
+	int i;
+
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			sfs_prefree(sv);
+		}
+	}
+}
+
+/*
+ * Allocate a block, as close after GOAL as possible. A GOAL of 0
+ * means no preference; then we carry on from wherever the last
+ * allocation left off, rather than rescanning from the start of the
+ * disk every time.
  */
 static
 int
-sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
+sfs_balloc(struct sfs_fs *sfs, u_int32_t goal, u_int32_t *diskblock)
 {
 	int result;
 
-	result = bitmap_alloc(sfs->sfs_freemap, diskblock);
+	if (goal == 0) {
+		goal = sfs->sfs_allochint;
+	}
+
+	result = bitmap_alloc_near(sfs->sfs_freemap, goal, diskblock);
+	if (result == ENOSPC) {
+		/* Blocks reserved for growth are better used than not */
+		sfs_prefreeall(sfs);
+		result = bitmap_alloc_near(sfs->sfs_freemap, goal, diskblock);
+	}
 	if (result) {
 		return result;
 	}
@@ -72,11 +259,54 @@ sfs_balloc(struct sfs_fs *sfs, u_int32_t *diskblock)
 	if (*diskblock >= sfs->sfs_super.sp_nblocks) {
 		panic("sfs: balloc: invalid block %u\n", *diskblock);
 	}
+	sfs->sfs_allochint = *diskblock + 1;
 
 	/* Clear block before returning it */
 	return sfs_clearblock(sfs, *diskblock);
 }
 
+/*
+ * Allocate a block for a file's data (or indirect blocks), placed
+ * right after GOAL if possible. GOAL is normally the block just
+ * before the new one in the file; if the file's reservation starts
+ * there, take the block from it.
+ */
+static
+int
+sfs_dballoc(struct sfs_vnode *sv, u_int32_t goal, u_int32_t *diskblock)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t block;
+	int result;
+
+	if (sv->sv_npre > 0 && sv->sv_prestart == goal) {
+		*diskblock = sv->sv_prestart;
+		sv->sv_prestart++;
+		sv->sv_npre--;
+		return sfs_clearblock(sfs, *diskblock);
+	}
+
+	/* Not where we reserved; the old reservation is no use */
+	sfs_prefree(sv);
+
+	result = sfs_balloc(sfs, goal, diskblock);
+	if (result) {
+		return result;
+	}
+
+	/* Reserve the free blocks that follow, up to the first used one */
+	sv->sv_prestart = *diskblock + 1;
+	for (block = sv->sv_prestart;
+	     block < sfs->sfs_super.sp_nblocks &&
+		     sv->sv_npre < SFS_PREALLOC-1 &&
+		     !bitmap_isset(sfs->sfs_freemap, block);
+	     block++) {
+		bitmap_mark(sfs->sfs_freemap, block);
+		sv->sv_npre++;
+	}
+	return 0;
+}
+
 /*
  * Free a block.
  */
@@ -106,6 +336,23 @@ sfs_bused(struct sfs_fs *sfs, u_int32_t diskblock)
 //
 // Block mapping/inode maintenance
 
+/*
+ * Return a pointer to the field of the inode that holds the top of
+ * the tree of indirect blocks LEVELS deep.
+ */
+static
+u_int32_t *
+sfs_indroot(struct sfs_vnode *sv, int levels)
+{
+	switch (levels) {
+	    case 1: return &sv->sv_i.sfi_indirect;
+	    case 2: return &sv->sv_i.sfi_dindirect;
+	    case 3: return &sv->sv_i.sfi_tindirect;
+	}
+	panic("sfs: no indirect block tree %d levels deep\n", levels);
+	return NULL;
+}
+
 /*
  * Look up the disk block number (from 0 up to the number of blocks on
  * the disk) given a file and the logical block number within that
@@ -117,22 +364,18 @@ int
 sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	    u_int32_t *diskblock)
 {
-	/*
-	 * I/O buffer for handling indirect blocks.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *idb;
+	u_int32_t *idbuf;
 	u_int32_t block;
 	u_int32_t idblock;
-	u_int32_t idnum, idoff;
+	u_int32_t *rootp;
+	u_int32_t idoff, span;
+	u_int32_t goal;
+	int levels, level;
 	int result;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	assert(SFS_DBPERIDB*sizeof(u_int32_t)==SFS_BLOCKSIZE);
 
 	/*
 	 * If the block we want is one of the direct blocks...
@@ -147,14 +390,20 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		 * Do we need to allocate?
 		 */
 		if (block==0 && doalloc) {
-			result = sfs_balloc(sfs, &block);
+			/* Try to put it right after the previous block */
+			goal = sv->sv_ino + 1;
+			if (fileblock > 0 && sv->sv_i.sfi_direct[fileblock-1]) {
+				goal = sv->sv_i.sfi_direct[fileblock-1] + 1;
+			}
+
+			result = sfs_dballoc(sv, goal, &block);
 			if (result) {
 				return result;
 			}
 
 			/* Remember what we allocated; mark inode dirty */
 			sv->sv_i.sfi_direct[fileblock] = block;
-			sv->sv_dirty = 1;
+			sfs_vdirty(sv);
 		}
 
 		/*
@@ -169,33 +418,39 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 	}
 
 	/*
-	 * It's not a direct block; it must be in the indirect block.
-	 * Subtract off the number of direct blocks, so FILEBLOCK is
-	 * now the offset into the indirect block space.
+	 * It's not a direct block, so it's in one of the trees of
+	 * indirect blocks: the single indirect block maps the next
+	 * SFS_DBPERIDB blocks, the double indirect block the
+	 * SFS_DBPERIDB^2 after that, and the triple indirect block the
+	 * SFS_DBPERIDB^3 after that. Find out which, leaving FILEBLOCK
+	 * as the offset within that tree and SPAN as the number of
+	 * blocks it maps.
 	 */
 
 	fileblock -= SFS_NDIRECT;
+	span = SFS_DBPERIDB;
+	for (levels = 1; levels <= SFS_NINDIRECT; levels++) {
+		if (fileblock < span) {
+			break;
+		}
+		fileblock -= span;
+		span *= SFS_DBPERIDB;
+	}
 
-	/* Get the indirect block number and offset w/i that indirect block */
-	idnum = fileblock / SFS_DBPERIDB;
-	idoff = fileblock % SFS_DBPERIDB;
-
-	/*
-	 * We only have one indirect block. If the offset we were asked for
-	 * is too large, we can't handle it, so fail.
-	 */
-	if (idnum > 0) {
+	/* If the offset is past the end of the largest tree, fail. */
+	if (levels > SFS_NINDIRECT) {
 		return EINVAL;
 	}
 
-	/* Get the disk block number of the indirect block. */
-	idblock = sv->sv_i.sfi_indirect;
+	/* Get the disk block number of the top of the tree. */
+	rootp = sfs_indroot(sv, levels);
+	idblock = *rootp;
 
 	if (idblock==0 && !doalloc) {
 		/*
 		 * There's no indirect block allocated. We weren't
-		 * asked to allocate anything, so pretend the indirect
-		 * block was filled with all zeros.
+		 * asked to allocate anything, so pretend the tree
+		 * was filled with all zeros.
 		 */
 		*diskblock = 0;
 		return 0;
@@ -204,51 +459,91 @@ sfs_bmap(struct sfs_vnode *sv, u_int32_t fileblock, int doalloc,
 		/*
 		 * There's no indirect block allocated, but we need to
 		 * allocate a block whose number needs to be stored in
-		 * the indirect block. Thus, we need to allocate an
-		 * indirect block.
+		 * the tree. Thus, we need to allocate the top of it.
+		 * Put it where the file's last allocation left off.
 		 */
-		result = sfs_balloc(sfs, &idblock);
+		goal = sv->sv_npre > 0 ? sv->sv_prestart : sv->sv_ino + 1;
+		if (levels == 1 && sv->sv_i.sfi_direct[SFS_NDIRECT-1]) {
+			goal = sv->sv_i.sfi_direct[SFS_NDIRECT-1] + 1;
+		}
+
+		result = sfs_dballoc(sv, goal, &idblock);
 		if (result) {
 			return result;
 		}
 
 		/* Remember the block we just allocated */
-		sv->sv_i.sfi_indirect = idblock;
+		*rootp = idblock;
 
 		/* Mark the inode dirty */
-		sv->sv_dirty = 1;
+		sfs_vdirty(sv);
 
-		/* Clear the indirect block buffer */
-		bzero(idbuf, sizeof(idbuf));
-	}
-	else {
 		/*
-		 * We already have an indirect block allocated; load it.
+		 * Older filesystems don't know about the deeper trees;
+		 * say so in the superblock once we start using them.
 		 */
-		result = sfs_rblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+		if (levels > 1 &&
+		    sfs->sfs_super.sp_version < SFS_VERSION_INDIRECT) {
+			sfs->sfs_super.sp_version = SFS_VERSION_INDIRECT;
+			sfs->sfs_superdirty = 1;
 		}
 	}
 
-	/* Get the block out of the indirect block buffer */
-	block = idbuf[idoff];
+	/*
+	 * Walk down the tree one indirect block per level. The
+	 * indirect blocks come from the buffer cache, so a file being
+	 * read or written in order finds them there every time but
+	 * the first. (A freshly allocated one was zeroed in the cache
+	 * by sfs_dballoc.)
+	 */
+	for (level = levels; level > 0; level--) {
+		span /= SFS_DBPERIDB;
+		idoff = (fileblock / span) % SFS_DBPERIDB;
 
-	/* If there's no block there, allocate one */
-	if (block==0 && doalloc) {
-		result = sfs_balloc(sfs, &block);
+		result = sfs_bread(sfs, idblock, &idb);
 		if (result) {
 			return result;
 		}
+		idbuf = idb->b_data;
 
-		/* Remember the block we allocated */
-		idbuf[idoff] = block;
+		/* Get the next block down out of the indirect block */
+		block = idbuf[idoff];
 
-		/* The indirect block is now dirty; write it back */
-		result = sfs_wblock(sfs, idbuf, idblock);
-		if (result) {
-			return result;
+		/* If there's no block there, allocate one */
+		if (block==0 && doalloc) {
+			/*
+			 * A data block goes after the data block
+			 * before it; an indirect block goes after the
+			 * file's last allocation, if we know where that
+			 * was, like the top of the tree.
+			 */
+			goal = idblock + 1;
+			if (level == 1 && idoff > 0 && idbuf[idoff-1]) {
+				goal = idbuf[idoff-1] + 1;
+			}
+			else if (level > 1 && idoff > 0 && sv->sv_npre > 0) {
+				goal = sv->sv_prestart;
+			}
+
+			result = sfs_dballoc(sv, goal, &block);
+			if (result) {
+				sfs_brelse(idb);
+				return result;
+			}
+
+			/* Remember the block we allocated */
+			idbuf[idoff] = block;
+
+			/* The indirect block is now dirty */
+			sfs_bdirty(idb);
 		}
+		sfs_brelse(idb);
+
+		/* A hole; the rest of the way down is all zeros too */
+		if (block == 0) {
+			break;
+		}
+		idblock = block;
 	}
 
 	/* Hand back the result and return. */
@@ -279,16 +574,8 @@ int
 sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	      u_int32_t skipstart, u_int32_t len)
 {
-	/*
-	 * I/O buffer for handling partial sectors.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static char iobuf[SFS_BLOCKSIZE];
-
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *b;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
@@ -310,40 +597,36 @@ sfs_partialio(struct sfs_vnode *sv, struct uio *uio,
 	if (diskblock == 0) {
 		/*
 		 * There was no block mapped at this point in the file.
-		 * Zero the buffer.
+		 * Read zeros.
 		 */
 		assert(uio->uio_rw == UIO_READ);
-		bzero(iobuf, sizeof(iobuf));
-	}
-	else {
-		/*
-		 * Read the block.
-		 */
-		result = sfs_rblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		return uiomovezeros(len, uio);
 	}
 
 	/*
-	 * Now perform the requested operation into/out of the buffer.
+	 * Get the block from the buffer cache.
 	 */
-	result = uiomove(iobuf+skipstart, len, uio);
+	result = sfs_bread(sfs, diskblock, &b);
 	if (result) {
 		return result;
 	}
 
 	/*
-	 * If it was a write, write back the modified block.
+	 * Now perform the requested operation into/out of the buffer.
+	 */
+	result = uiomove((char *)b->b_data+skipstart, len, uio);
+
+	/*
+	 * If it was a write, the block is now dirty. This is so even if
+	 * uiomove faulted part way; whatever it copied is part of the
+	 * file now, just as if it had been a shorter write.
 	 */
 	if (uio->uio_rw == UIO_WRITE) {
-		result = sfs_wblock(sfs, iobuf, diskblock);
-		if (result) {
-			return result;
-		}
+		sfs_bdirty(b);
 	}
 
-	return 0;
+	sfs_brelse(b);
+	return result;
 }
 
 /*
@@ -354,14 +637,11 @@ int
 sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 {
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *b;
 	u_int32_t diskblock;
 	u_int32_t fileblock;
 	int result;
 	int doalloc = (uio->uio_rw==UIO_WRITE);
-	off_t saveoff;
-	off_t diskoff;
-	off_t saveres;
-	off_t diskres;
 
 	/* Get the block number within the file */
 	fileblock = uio->uio_offset / SFS_BLOCKSIZE;
@@ -384,33 +664,210 @@ sfs_blockio(struct sfs_vnode *sv, struct uio *uio)
 	}
 
 	/*
-	 * Do the I/O directly to the uio region. Save the uio_offset,
-	 * and substitute one that makes sense to the device.
-	 */
-	saveoff = uio->uio_offset;
-	diskoff = diskblock * SFS_BLOCKSIZE;
-	uio->uio_offset = diskoff;
-
-	/*
-	 * Temporarily set the residue to be one block size.
+	 * Go through the buffer cache, so that it never holds a stale
+	 * copy of a block. A write covers the whole block, so there is
+	 * no need to read it first.
 	 */
 	assert(uio->uio_resid >= SFS_BLOCKSIZE);
-	saveres = uio->uio_resid;
-	diskres = SFS_BLOCKSIZE;
-	uio->uio_resid = diskres;
-	
-	result = sfs_rwblock(sfs, uio);
+	if (uio->uio_rw == UIO_READ) {
+		result = sfs_bread(sfs, diskblock, &b);
+	}
+	else {
+		result = sfs_bget(sfs, diskblock, &b);
+	}
+	if (result) {
+		return result;
+	}
+
+	result = uiomove(b->b_data, SFS_BLOCKSIZE, uio);
 
 	/*
-	 * Now, restore the original uio_offset and uio_resid and update 
-	 * them by the amount of I/O done.
+	 * A write that faulted part way leaves the rest of the buffer
+	 * garbage unless it already held the block, in which case we
+	 * keep what was copied, as sfs_partialio does.
 	 */
-	uio->uio_offset = (uio->uio_offset - diskoff) + saveoff;
-	uio->uio_resid = (uio->uio_resid - diskres) + saveres;
+	if (uio->uio_rw == UIO_WRITE && (result == 0 || b->b_valid)) {
+		sfs_bdirty(b);
+	}
+
+	sfs_brelse(b);
+	return result;
+}
+
+/*
+ * Before reading NBLOCKS whole blocks starting at FILEBLOCK, get them
+ * into the buffer cache, passing each run of blocks that are
+ * consecutive on disk down to the device as one transfer. sfs_blockio
+ * then finds them all cached. sfs_io does this SFS_FILLMAX blocks at a
+ * time, so a huge read doesn't push its own start out of the cache.
+ */
+#define SFS_FILLMAX  32
+
+static
+int
+sfs_fillblocks(struct sfs_vnode *sv, u_int32_t fileblock, u_int32_t nblocks)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t i, diskblock, runstart, runlen;
+	int result;
+
+	runstart = runlen = 0;
+	for (i=0; i<nblocks; i++) {
+		result = sfs_bmap(sv, fileblock+i, 0, &diskblock);
+		if (result) {
+			return result;
+		}
+		if (runlen > 0 && diskblock == runstart + runlen) {
+			runlen++;
+			continue;
+		}
+		if (runlen > 0) {
+			sfs_bfill(sfs, runstart, runlen);
+		}
+		/* Holes read as zeros and need nothing */
+		runstart = diskblock;
+		runlen = (diskblock != 0);
+	}
+	if (runlen > 0) {
+		sfs_bfill(sfs, runstart, runlen);
+	}
+	return 0;
+}
+
+/*
+ * Read-ahead.
+ *
+ * Each vnode remembers where the last read left off. A read that
+ * starts there (or at the beginning of the file, the first time) is
+ * taken as sequential, and the read-ahead window opens to SFS_RAMIN
+ * blocks, doubling with each further sequential read up to SFS_RAMAX.
+ * After each such read we ask the buffer cache to prefetch whatever
+ * part of the window past the read hasn't been asked for already.
+ * A read anywhere else closes the window again.
+ *
+ * None of this is locked; concurrent readers of one file can confuse
+ * it, but the worst that happens is a wasted or missing prefetch.
+ */
+#define SFS_RAMIN  4
+#define SFS_RAMAX  32
+
+static
+void
+sfs_readahead(struct sfs_vnode *sv, u_int32_t startblock, off_t endpos)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	u_int32_t fileblock, lastblock, diskblock;
+
+	if (startblock == sv->sv_ranext) {
+		if (sv->sv_rawindow == 0) {
+			sv->sv_rawindow = SFS_RAMIN;
+		}
+		else if (sv->sv_rawindow < SFS_RAMAX) {
+			sv->sv_rawindow *= 2;
+		}
+	}
+	else {
+		sv->sv_rawindow = 0;
+		sv->sv_raend = 0;
+	}
+	sv->sv_ranext = endpos / SFS_BLOCKSIZE;
+
+	if (sv->sv_rawindow == 0) {
+		return;
+	}
+
+	/* Don't go past EOF */
+	lastblock = sv->sv_ranext + sv->sv_rawindow;
+	if (lastblock > DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE)) {
+		lastblock = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	}
+
+	fileblock = sv->sv_ranext;
+	if (fileblock < sv->sv_raend) {
+		fileblock = sv->sv_raend;
+	}
+	for (; fileblock < lastblock; fileblock++) {
+		if (sfs_bmap(sv, fileblock, 0, &diskblock)) {
+			break;
+		}
+		if (diskblock != 0) {
+			sfs_bprefetch(sfs, diskblock);
+		}
+	}
+	if (fileblock > sv->sv_raend) {
+		sv->sv_raend = fileblock;
+	}
+}
+
+/*
+ * Inline data.
+ *
+ * On filesystems new enough for it, files and directories start out
+ * with their data in the inode itself (SFS_IFLAG_INLINE), so reading
+ * a small one takes only the one disk access that gets the inode.
+ * Once one grows past SFS_INLINESIZE bytes its data moves out to an
+ * ordinary block and it stays block-mapped from then on. The part of
+ * sfi_inline past EOF is always kept zeroed.
+ */
+
+/*
+ * Do I/O to the data of an inline file. The transfer must fit.
+ */
+static
+int
+sfs_inlineio(struct sfs_vnode *sv, struct uio *uio)
+{
+	int result;
+
+	assert(uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE);
 
+	result = uiomove(sv->sv_i.sfi_inline + uio->uio_offset,
+			 uio->uio_resid, uio);
+
+	/* As with blocks, whatever got copied before a fault stays */
+	if (uio->uio_rw == UIO_WRITE) {
+		sfs_vdirty(sv);
+	}
 	return result;
 }
 
+/*
+ * Move the data of an inline file out to the file's first block.
+ */
+static
+int
+sfs_uninline(struct sfs_vnode *sv)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	struct sfs_buf *b;
+	u_int32_t diskblock;
+	int result;
+
+	assert(sv->sv_i.sfi_flags & SFS_IFLAG_INLINE);
+	assert(sv->sv_i.sfi_size <= SFS_INLINESIZE);
+
+	if (sv->sv_i.sfi_size > 0) {
+		result = sfs_bmap(sv, 0, 1, &diskblock);
+		if (result) {
+			return result;
+		}
+
+		/* Freshly allocated, so it's in the cache and zeroed */
+		result = sfs_bread(sfs, diskblock, &b);
+		if (result) {
+			return result;
+		}
+		memcpy(b->b_data, sv->sv_i.sfi_inline, sv->sv_i.sfi_size);
+		sfs_bdirty(b);
+		sfs_brelse(b);
+	}
+
+	bzero(sv->sv_i.sfi_inline, SFS_INLINESIZE);
+	sv->sv_i.sfi_flags &= ~SFS_IFLAG_INLINE;
+	sfs_vdirty(sv);
+	return 0;
+}
+
 /*
  * Do I/O of a whole region of data, whether or not it's block-aligned.
  */
@@ -420,6 +877,7 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 {
 	u_int32_t blkoff;
 	u_int32_t nblocks, i;
+	u_int32_t startblock;
 	int result = 0;
 	u_int32_t extraresid = 0;
 
@@ -443,6 +901,23 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 			uio->uio_resid -= extraresid;
 		}
 	}
+	startblock = uio->uio_offset / SFS_BLOCKSIZE;
+
+	/*
+	 * If the data is in the inode, do it there, unless it's a write
+	 * that won't fit; then move the data out to a block first.
+	 */
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (uio->uio_rw == UIO_READ ||
+		    uio->uio_offset + uio->uio_resid <= SFS_INLINESIZE) {
+			result = sfs_inlineio(sv, uio);
+			goto out;
+		}
+		result = sfs_uninline(sv);
+		if (result) {
+			goto out;
+		}
+	}
 
 	/*
 	 * First, do any leading partial block.
@@ -478,6 +953,20 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	assert(uio->uio_offset % SFS_BLOCKSIZE == 0);
 	nblocks = uio->uio_resid / SFS_BLOCKSIZE;
 	for (i=0; i<nblocks; i++) {
+		/* Bring in the next batch with as few transfers as we can */
+		if (uio->uio_rw == UIO_READ && i % SFS_FILLMAX == 0 &&
+		    nblocks - i > 1) {
+			u_int32_t n = nblocks - i;
+			if (n > SFS_FILLMAX) {
+				n = SFS_FILLMAX;
+			}
+			result = sfs_fillblocks(sv,
+					uio->uio_offset / SFS_BLOCKSIZE, n);
+			if (result) {
+				goto out;
+			}
+		}
+
 		result = sfs_blockio(sv, uio);
 		if (result) {
 			goto out;
@@ -498,11 +987,17 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 
  out:
 
+	/* If reading, keep ahead of the reader */
+	if (uio->uio_rw == UIO_READ && result == 0 &&
+	    (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) == 0) {
+		sfs_readahead(sv, startblock, uio->uio_offset);
+	}
+
 	/* If writing, adjust file length */
 	if (uio->uio_rw == UIO_WRITE && 
 	    uio->uio_offset > (off_t)sv->sv_i.sfi_size) {
 		sv->sv_i.sfi_size = uio->uio_offset;
-		sv->sv_dirty = 1;
+		sfs_vdirty(sv);
 	}
 
 	/* Add in any extra amount we couldn't read because of EOF */
@@ -609,6 +1104,9 @@ sfs_dir_nentries(struct sfs_vnode *sv)
  * Search a directory for a particular filename in a directory, and
  * return its inode number, its slot, and/or the slot number of an
  * empty directory slot if one is found.
+ *
+ * The caller must hold sv_dirlock, shared for a plain lookup or
+ * exclusive if it is about to change the directory.
  */
 
 static
@@ -770,7 +1268,7 @@ sfs_makeobj(struct sfs_fs *sfs, int type, struct sfs_vnode **ret)
 	 * number is the block number, so just get a block.)
 	 */
 
-	result = sfs_balloc(sfs, &ino);
+	result = sfs_balloc(sfs, 0, &ino);
 	if (result) {
 		return result;
 	}
@@ -795,17 +1293,15 @@ sfs_open(struct vnode *v, int openflags)
 {
 	/*
 	 * At this level we do not need to handle O_CREAT, O_EXCL, or O_TRUNC.
-	 * We *would* need to handle O_APPEND, but we don't support it.
+	 * O_APPEND is handled by the open file layer, which moves the
+	 * offset to the end before each write.
 	 *
 	 * Any of O_RDONLY, O_WRONLY, and O_RDWR are valid, so we don't need
 	 * to check that either.
 	 */
 
-	if (openflags & O_APPEND) {
-		return EUNIMP;
-	}
-
 	(void)v;
+	(void)openflags;
 
 	return 0;
 }
@@ -844,8 +1340,19 @@ static
 int
 sfs_close(struct vnode *v)
 {
-	/* Sync it. */
-	return VOP_FSYNC(v);
+	struct sfs_vnode *sv = v->vn_data;
+
+	/*
+	 * Nobody has it open to write to any more. (The vnode may stay
+	 * loaded a long time, held by the name cache.)
+	 */
+	sfs_prefree(sv);
+
+	/*
+	 * Push the inode into the buffer cache. Getting it and the data
+	 * onto the disk is up to the flusher, or to fsync.
+	 */
+	return sfs_sync_inode(sv);
 }
 
 /*
@@ -859,7 +1366,7 @@ sfs_reclaim(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = v->vn_fs->fs_data;
-	int ix, i, num, result;
+	int result;
 
 	/*
 	 * Make sure someone else hasn't picked up the vnode since the
@@ -877,7 +1384,9 @@ sfs_reclaim(struct vnode *v)
 		return EBUSY;
 	}
 	lock_release(v->vn_countlock);
-	
+
+	/* Nobody is going to write to it any more */
+	sfs_prefree(sv);
 
 	/* If there are no on-disk references to the file either, erase it. */
 	if (sv->sv_i.sfi_linkcount==0) {
@@ -899,24 +1408,15 @@ sfs_reclaim(struct vnode *v)
 	}
 
 	/* Remove the vnode structure from the table in the struct sfs_fs. */
-	ix = -1;
-	num = array_getnum(sfs->sfs_vnodes);
-	for (i=0; i<num; i++) {
-		struct sfs_vnode *sv2 = array_getguy(sfs->sfs_vnodes, i);
-		if (sv2==sv) {
-			ix = i;
-			break;
-		}
-	}
-	if (ix<0) {
-		panic("sfs: reclaim vnode %u not in vnode pool\n",
-		      sv->sv_ino);
-	}
-	array_remove(sfs->sfs_vnodes, ix);
+	assert(sv->sv_dirty == 0);
+	sfs_vnremove(sfs, sv);
 
 	VOP_KILL(&sv->sv_v);
 
 	/* Release the storage for the vnode structure itself. */
+	if (sv->sv_dirlock != NULL) {
+		rwlock_destroy(sv->sv_dirlock);
+	}
 	kfree(sv);
 
 	/* Done */
@@ -1034,6 +1534,49 @@ sfs_tryseek(struct vnode *v, off_t pos)
 	return 0;
 }
 
+/*
+ * Write back the blocks in the tree of indirect blocks LEVELS deep
+ * whose top is BLOCK, the data first and then the indirect blocks
+ * that point to it.
+ */
+static
+int
+sfs_flushind(struct sfs_fs *sfs, u_int32_t block, int levels)
+{
+	struct sfs_buf *idb;
+	u_int32_t *idbuf;
+	int j, result;
+
+	if (block == 0) {
+		return 0;
+	}
+
+	result = sfs_bread(sfs, block, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = idb->b_data;
+
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (idbuf[j] == 0) {
+			continue;
+		}
+		if (levels == 1) {
+			result = sfs_bflushblock(sfs, idbuf[j]);
+		}
+		else {
+			result = sfs_flushind(sfs, idbuf[j], levels-1);
+		}
+		if (result) {
+			sfs_brelse(idb);
+			return result;
+		}
+	}
+	sfs_brelse(idb);
+
+	return sfs_bflushblock(sfs, block);
+}
+
 /*
  * Called for fsync(), and also on filesystem unmount, global sync(),
  * and some other cases.
@@ -1043,7 +1586,34 @@ int
 sfs_fsync(struct vnode *v)
 {
 	struct sfs_vnode *sv = v->vn_data;
-	return sfs_sync_inode(sv);
+	struct sfs_fs *sfs = v->vn_fs->fs_data;
+	int i, levels, result;
+
+	result = sfs_sync_inode(sv);
+	if (result) {
+		return result;
+	}
+
+	/*
+	 * Write back this file's blocks and nobody else's (apart from
+	 * neighbours the cache chooses to write along with them).
+	 */
+	for (i=0; i<SFS_NDIRECT; i++) {
+		if (sv->sv_i.sfi_direct[i] != 0) {
+			result = sfs_bflushblock(sfs, sv->sv_i.sfi_direct[i]);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	for (levels = 1; levels <= SFS_NINDIRECT; levels++) {
+		result = sfs_flushind(sfs, *sfs_indroot(sv, levels), levels);
+		if (result) {
+			return result;
+		}
+	}
+
+	return sfs_bflushblock(sfs, sv->sv_ino);
 }
 
 /*
@@ -1057,6 +1627,87 @@ sfs_mmap(struct vnode *v   /* add stuff as needed */)
 	return EUNIMP;
 }
 
+/*
+ * Free the blocks at or past file block BLOCKLEN in the tree of
+ * indirect blocks LEVELS deep whose top is *BLOCKP, and which maps
+ * file blocks from BASEBLOCK up. If that leaves the tree empty, free
+ * the top block too, zero *BLOCKP, and set *DIRTYP to say it changed.
+ */
+static
+int
+sfs_truncind(struct sfs_fs *sfs, u_int32_t *blockp, int levels,
+	     u_int32_t baseblock, u_int32_t blocklen, int *dirtyp)
+{
+	struct sfs_buf *idb;
+	u_int32_t *idbuf;
+	u_int32_t j, span;
+	int l, result;
+	int hasnonzero, iddirty;
+
+	/* Number of file blocks under each entry */
+	span = 1;
+	for (l=1; l<levels; l++) {
+		span *= SFS_DBPERIDB;
+	}
+
+	if (*blockp == 0 || blocklen >= baseblock + span*SFS_DBPERIDB) {
+		/* Nothing here, or nothing past the proposed EOF */
+		return 0;
+	}
+
+	/* Read the indirect block */
+	result = sfs_bread(sfs, *blockp, &idb);
+	if (result) {
+		return result;
+	}
+	idbuf = idb->b_data;
+
+	hasnonzero = 0;
+	iddirty = 0;
+	for (j=0; j<SFS_DBPERIDB; j++) {
+		if (levels == 1) {
+			/* Discard any blocks that are past the new EOF */
+			if (blocklen <= baseblock+j && idbuf[j] != 0) {
+				sfs_bfree(sfs, idbuf[j]);
+				idbuf[j] = 0;
+				iddirty = 1;
+			}
+		}
+		else {
+			/* Trim the subtree under this entry */
+			result = sfs_truncind(sfs, &idbuf[j], levels-1,
+					      baseblock + j*span, blocklen,
+					      &iddirty);
+			if (result) {
+				if (iddirty) {
+					sfs_bdirty(idb);
+				}
+				sfs_brelse(idb);
+				return result;
+			}
+		}
+		/* Remember if we see any nonzero blocks in here */
+		if (idbuf[j]!=0) {
+			hasnonzero=1;
+		}
+	}
+
+	if (!hasnonzero) {
+		/* The whole indirect block is empty now; free it */
+		sfs_brelse(idb);
+		sfs_bfree(sfs, *blockp);
+		*blockp = 0;
+		*dirtyp = 1;
+	}
+	else {
+		if (iddirty) {
+			sfs_bdirty(idb);
+		}
+		sfs_brelse(idb);
+	}
+	return 0;
+}
+
 /*
  * Called for ftruncate() and from sfs_reclaim.
  */
@@ -1064,27 +1715,36 @@ static
 int
 sfs_truncate(struct vnode *v, off_t len)
 {
-	/*
-	 * I/O buffer for handling the indirect block.
-	 *
-	 * Note: in real life (and when you've done the fs assignment)
-	 * you would get space from the disk buffer cache for this,
-	 * not use a static area.
-	 */
-	static u_int32_t idbuf[SFS_DBPERIDB];
-
 	struct sfs_vnode *sv = v->vn_data;
 	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
 
 	/* Length in blocks (divide rounding up) */
 	u_int32_t blocklen = DIVROUNDUP(len, SFS_BLOCKSIZE);
 
-	u_int32_t i, j, block;
-	u_int32_t idblock, baseblock, highblock;
+	u_int32_t i, block;
+	u_int32_t baseblock, span;
+	int levels, changed;
 	int result;
-	int hasnonzero, iddirty;
 
-	assert(sizeof(idbuf)==SFS_BLOCKSIZE);
+	/*
+	 * An inline file that stays small just needs the data past the
+	 * new EOF zeroed; one growing past that moves out to a block.
+	 */
+	if (sv->sv_i.sfi_flags & SFS_IFLAG_INLINE) {
+		if (len <= (off_t)SFS_INLINESIZE) {
+			bzero(sv->sv_i.sfi_inline + len, SFS_INLINESIZE - len);
+			sv->sv_i.sfi_size = len;
+			sfs_vdirty(sv);
+			return 0;
+		}
+		result = sfs_uninline(sv);
+		if (result) {
+			return result;
+		}
+	}
+
+	/* Any reservation was for growing past the old end; drop it */
+	sfs_prefree(sv);
 
 	/*
 	 * Go through the direct blocks. Discard any that are
@@ -1095,63 +1755,32 @@ sfs_truncate(struct vnode *v, off_t len)
 		if (i >= blocklen && block != 0) {
 			sfs_bfree(sfs, block);
 			sv->sv_i.sfi_direct[i] = 0;
-			sv->sv_dirty = 1;
+			sfs_vdirty(sv);
 		}
 	}
 
-	/* Indirect block number */
-	idblock = sv->sv_i.sfi_indirect;
-
-	/* The lowest block in the indirect block */
+	/*
+	 * Go through the trees of indirect blocks, freeing whatever
+	 * is past the limit, including any indirect blocks left empty.
+	 */
 	baseblock = SFS_NDIRECT;
-
-	/* The highest block in the indirect block */
-	highblock = baseblock + SFS_DBPERIDB - 1;
-
-	if (blocklen < highblock && idblock != 0) {
-		/* We're past the proposed EOF; may need to free stuff */
-
-		/* Read the indirect block */
-		result = sfs_rblock(sfs, idbuf, idblock);
+	span = SFS_DBPERIDB;
+	for (levels = 1; levels <= SFS_NINDIRECT; levels++) {
+		/* The inode gets marked dirty below in any case */
+		result = sfs_truncind(sfs, sfs_indroot(sv, levels), levels,
+				      baseblock, blocklen, &changed);
 		if (result) {
 			return result;
 		}
-		
-		hasnonzero = 0;
-		iddirty = 0;
-		for (j=0; j<SFS_DBPERIDB; j++) {
-			/* Discard any blocks that are past the new EOF */
-			if (blocklen < baseblock+j && idbuf[j] != 0) {
-				sfs_bfree(sfs, idbuf[j]);
-				idbuf[j] = 0;
-				iddirty = 1;
-			}
-			/* Remember if we see any nonzero blocks in here */
-			if (idbuf[j]!=0) {
-				hasnonzero=1;
-			}
-		}
-
-		if (!hasnonzero) {
-			/* The whole indirect block is empty now; free it */
-			sfs_bfree(sfs, idblock);
-			sv->sv_i.sfi_indirect = 0;
-			sv->sv_dirty = 1;
-		}
-		else if (iddirty) {
-			/* The indirect block is dirty; write it back */
-			result = sfs_wblock(sfs, idbuf, idblock);
-			if (result) {
-				return result;
-			}
-		}
+		baseblock += span;
+		span *= SFS_DBPERIDB;
 	}
 
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
 	/* Mark the inode dirty */
-	sv->sv_dirty = 1;
+	sfs_vdirty(sv);
 	
 	return 0;
 }
@@ -1190,49 +1819,68 @@ sfs_creat(struct vnode *v, const char *name, int excl, struct vnode **ret)
 	u_int32_t ino;
 	int result;
 
+	rwlock_acquire_write(sv->sv_dirlock);
+
+	/* If the name cache knows the file exists, we needn't search */
+	if (vfs_nclookup(v, name, ret) && *ret != NULL) {
+		if (excl) {
+			VOP_DECREF(*ret);
+			result = EEXIST;
+		}
+		else {
+			result = 0;
+		}
+		goto out;
+	}
+
 	/* Look up the name */
 	result = sfs_dir_findname(sv, name, &ino, NULL, NULL);
 	if (result!=0 && result!=ENOENT) {
-		return result;
+		goto out;
 	}
 
 	/* If it exists and we didn't want it to, fail */
 	if (result==0 && excl) {
-		return EEXIST;
+		result = EEXIST;
+		goto out;
 	}
 
 	if (result==0) {
 		/* We got a file; load its vnode and return */
 		result = sfs_loadvnode(sfs, ino, SFS_TYPE_INVAL, &newguy);
 		if (result) {
-			return result;
+			goto out;
 		}
 		*ret = &newguy->sv_v;
-		return 0;
+		goto out;
 	}
 
 	/* Didn't exist - create it */
 	result = sfs_makeobj(sfs, SFS_TYPE_FILE, &newguy);
 	if (result) {
-		return result;
+		goto out;
 	}
 
-	/* Link it into the directory */
+	/* Link it into the directory, replacing any negative cache entry */
+	vfs_ncpurge(v, name);
 	result = sfs_dir_link(sv, name, newguy->sv_ino, NULL);
 	if (result) {
 		VOP_DECREF(&newguy->sv_v);
-		return result;
+		goto out;
 	}
+	vfs_ncenter(v, name, &newguy->sv_v);
 
 	/* Update the linkcount of the new file */
 	newguy->sv_i.sfi_linkcount++;
 
 	/* and consequently mark it dirty. */
-	newguy->sv_dirty = 1;
+	sfs_vdirty(newguy);
 
 	*ret = &newguy->sv_v;
 	
-	return 0;
+ out:
+	rwlock_release_write(sv->sv_dirlock);
+	return result;
 }
 
 /*
@@ -1250,15 +1898,18 @@ sfs_link(struct vnode *dir, const char *name, struct vnode *file)
 
 	assert(file->vn_fs == dir->vn_fs);
 
-	/* Just create a link */
+	/* Just create a link (the name may be cached as not existing) */
+	rwlock_acquire_write(sv->sv_dirlock);
+	vfs_ncpurge(dir, name);
 	result = sfs_dir_link(sv, name, f->sv_ino, NULL);
+	rwlock_release_write(sv->sv_dirlock);
 	if (result) {
 		return result;
 	}
 
 	/* and update the link count, marking the inode dirty */
 	f->sv_i.sfi_linkcount++;
-	f->sv_dirty = 1;
+	sfs_vdirty(f);
 
 	return 0;
 }
@@ -1275,21 +1926,30 @@ sfs_remove(struct vnode *dir, const char *name)
 	int slot;
 	int result;
 
+	rwlock_acquire_write(sv->sv_dirlock);
+
 	/* Look for the file and fetch a vnode for it. */
 	result = sfs_lookonce(sv, name, &victim, &slot);
 	if (result) {
+		rwlock_release_write(sv->sv_dirlock);
 		return result;
 	}
 
-	/* Erase its directory entry. */
+	/*
+	 * Erase its directory entry. Forget the name first, so the name
+	 * cache lets go of the file.
+	 */
+	vfs_ncpurge(dir, name);
 	result = sfs_dir_unlink(sv, slot);
 	if (result==0) {
 		/* If we succeeded, decrement the link count. */
 		assert(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
-		victim->sv_dirty = 1;
+		sfs_vdirty(victim);
 	}
 
+	rwlock_release_write(sv->sv_dirlock);
+
 	/* Discard the reference that sfs_lookonce got us */
 	VOP_DECREF(&victim->sv_v);
 
@@ -1315,9 +1975,12 @@ sfs_rename(struct vnode *d1, const char *n1,
 	assert(d1==d2);
 	assert(sv->sv_ino == SFS_ROOT_LOCATION);
 
+	rwlock_acquire_write(sv->sv_dirlock);
+
 	/* Look up the old name of the file and get its inode and slot number*/
 	result = sfs_lookonce(sv, n1, &g1, &slot1);
 	if (result) {
+		rwlock_release_write(sv->sv_dirlock);
 		return result;
 	}
 
@@ -1332,6 +1995,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 * the new name doesn't already exist; might as well use the
 	 * existing link routine.
 	 */
+	vfs_ncpurge(d1, n1);
+	vfs_ncpurge(d2, n2);
 	result = sfs_dir_link(sv, n2, g1->sv_ino, &slot2);
 	if (result) {
 		goto puke;
@@ -1339,7 +2004,7 @@ sfs_rename(struct vnode *d1, const char *n1,
 	
 	/* Increment the link count, and mark inode dirty */
 	g1->sv_i.sfi_linkcount++;
-	g1->sv_dirty = 1;
+	sfs_vdirty(g1);
 
 	/* Unlink the old slot */
 	result = sfs_dir_unlink(sv, slot1);
@@ -1353,7 +2018,9 @@ sfs_rename(struct vnode *d1, const char *n1,
 	 */
 	assert(g1->sv_i.sfi_linkcount>0);
 	g1->sv_i.sfi_linkcount--;
-	g1->sv_dirty = 1;
+	sfs_vdirty(g1);
+
+	rwlock_release_write(sv->sv_dirlock);
 
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
@@ -1373,6 +2040,8 @@ sfs_rename(struct vnode *d1, const char *n1,
 	}
 	g1->sv_i.sfi_linkcount--;
  puke:
+	rwlock_release_write(sv->sv_dirlock);
+
 	/* Let go of the reference to g1 */
 	VOP_DECREF(&g1->sv_v);
 	return result;
@@ -1425,7 +2094,24 @@ sfs_lookup(struct vnode *v, char *path, struct vnode **ret)
 		return ENOTDIR;
 	}
 	
+	/*
+	 * Lookups only read the directory, so they can run side by side.
+	 * Whatever we find goes in the name cache; that happens under
+	 * the lock so it can't race with a change to the directory.
+	 */
+	rwlock_acquire_read(sv->sv_dirlock);
+	if (vfs_nclookup(v, path, ret)) {
+		rwlock_release_read(sv->sv_dirlock);
+		return *ret != NULL ? 0 : ENOENT;
+	}
 	result = sfs_lookonce(sv, path, &final, NULL);
+	if (result == 0) {
+		vfs_ncenter(v, path, &final->sv_v);
+	}
+	else if (result == ENOENT) {
+		vfs_ncenter(v, path, NULL);
+	}
+	rwlock_release_read(sv->sv_dirlock);
 	if (result) {
 		return result;
 	}
@@ -1549,32 +2235,23 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 {
 	struct sfs_vnode *sv;
 	const struct vnode_ops *ops = NULL;
-	int i, num;
 	int result;
 
 	/* Look in the vnodes table */
-	num = array_getnum(sfs->sfs_vnodes);
-
-	/* Linear search. Is this too slow? You decide. */
-	for (i=0; i<num; i++) {
-		sv = array_getguy(sfs->sfs_vnodes, i);
-
+	sv = sfs_vnfind(sfs, ino);
+	if (sv != NULL) {
 		/* Every inode in memory must be in an allocated block */
 		if (!sfs_bused(sfs, sv->sv_ino)) {
 			panic("sfs: Found inode %u in unallocated block\n",
 			      sv->sv_ino);
 		}
 
-		if (sv->sv_ino==ino) {
-			/* Found */
+		/* May only be set when creating new objects */
+		assert(forcetype==SFS_TYPE_INVAL);
 
-			/* May only be set when creating new objects */
-			assert(forcetype==SFS_TYPE_INVAL);
-
-			VOP_INCREF(&sv->sv_v);
-			*ret = sv;
-			return 0;
-		}
+		VOP_INCREF(&sv->sv_v);
+		*ret = sv;
+		return 0;
 	}
 
 	/* Didn't have it loaded; load it */
@@ -1597,8 +2274,19 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		return result;
 	}
 
-	/* Not dirty yet */
+	/* Not dirty yet, and not in any lists */
 	sv->sv_dirty = 0;
+	sv->sv_hashnext = NULL;
+	sv->sv_dirtyprev = sv->sv_dirtynext = NULL;
+
+	/* No reads yet */
+	sv->sv_ranext = 0;
+	sv->sv_rawindow = 0;
+	sv->sv_raend = 0;
+
+	/* No blocks reserved */
+	sv->sv_prestart = 0;
+	sv->sv_npre = 0;
 
 	/*
 	 * FORCETYPE is set if we're creating a new file, because the
@@ -1608,7 +2296,9 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	if (forcetype != SFS_TYPE_INVAL) {
 		assert(sv->sv_i.sfi_type == SFS_TYPE_INVAL);
 		sv->sv_i.sfi_type = forcetype;
-		sv->sv_dirty = 1;
+		if (sfs->sfs_super.sp_version >= SFS_VERSION_INLINE) {
+			sv->sv_i.sfi_flags |= SFS_IFLAG_INLINE;
+		}
 	}
 
 	/*
@@ -1627,9 +2317,22 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 		      ino, sv->sv_i.sfi_type);
 	}
 
+	/* Directories get a reader-writer lock for their entries */
+	sv->sv_dirlock = NULL;
+	if (sv->sv_i.sfi_type == SFS_TYPE_DIR) {
+		sv->sv_dirlock = rwlock_create("sfs dir");
+		if (sv->sv_dirlock == NULL) {
+			kfree(sv);
+			return ENOMEM;
+		}
+	}
+
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
+		if (sv->sv_dirlock != NULL) {
+			rwlock_destroy(sv->sv_dirlock);
+		}
 		kfree(sv);
 		return result;
 	}
@@ -1638,11 +2341,11 @@ sfs_loadvnode(struct sfs_fs *sfs, u_int32_t ino, int forcetype,
 	sv->sv_ino = ino;
 
 	/* Add it to our table */
-	result = array_add(sfs->sfs_vnodes, sv);
-	if (result) {
-		VOP_KILL(&sv->sv_v);
-		kfree(sv);
-		return result;
+	sfs_vnadd(sfs, sv);
+
+	/* A new object's inode has yet to be written */
+	if (forcetype != SFS_TYPE_INVAL) {
+		sfs_vdirty(sv);
 	}
 
 	/* Hand it back */
@@ -1668,3 +2371,46 @@ sfs_getroot(struct fs *fs)
 
 	return &sv->sv_v;
 }
+
+/*
+ * Print statistics about the vnode table.
+ */
+int
+sfs_vnstats(struct vnode *v)
+{
+	struct sfs_fs *sfs;
+	struct sfs_vnode *sv;
+	int i, len, used, longest, ndirty;
+
+	if (v->vn_ops != &sfs_fileops && v->vn_ops != &sfs_dirops) {
+		return EINVAL;
+	}
+	sfs = v->vn_fs->fs_data;
+
+	used = longest = 0;
+	for (i=0; i<SFS_VNHASHSIZE; i++) {
+		len = 0;
+		for (sv = sfs->sfs_vnhash[i]; sv != NULL; sv = sv->sv_hashnext) {
+			len++;
+		}
+		if (len > 0) {
+			used++;
+		}
+		if (len > longest) {
+			longest = len;
+		}
+	}
+
+	ndirty = 0;
+	for (sv = sfs->sfs_dirtyvn; sv != NULL; sv = sv->sv_dirtynext) {
+		ndirty++;
+	}
+
+	kprintf("sfs %s: %d vnodes loaded, %d dirty\n",
+		sfs->sfs_super.sp_volname, sfs->sfs_nvnodes, ndirty);
+	kprintf("    %d/%d chains in use, longest %d\n",
+		used, SFS_VNHASHSIZE, longest);
+	kprintf("    %u lookups, %u chain entries examined\n",
+		sfs->sfs_vnlookups, sfs->sfs_vnprobes);
+	return 0;
+}
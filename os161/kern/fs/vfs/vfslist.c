@@ -52,7 +52,12 @@ struct knowndev {
 };
 
 static struct array *knowndevs;
-static struct lock *knowndevs_lock;
+/*
+ * Lookups (vfs_getroot, vfs_getdevname, vfs_sync) only read the table
+ * and take knowndevs_lock shared; adding devices and mounting or
+ * unmounting take it exclusive.
+ */
+static struct rwlock *knowndevs_lock;
 
 /*
  * Setup function
@@ -64,12 +69,13 @@ vfs_bootstrap(void)
 	if (knowndevs==NULL) {
 		panic("vfs: Could not create knowndevs array\n");
 	}
-	knowndevs_lock = lock_create("knowndevs");
+	knowndevs_lock = rwlock_create("knowndevs");
 	if (knowndevs_lock==NULL) {
 		panic("vfs: Could not create knowndevs lock\n");
 	}
 
 	vfs_initbootfs();
+	vfs_ncbootstrap();
 	devnull_create();
 }
 
@@ -82,7 +88,7 @@ vfs_sync(void)
 	struct knowndev *dev;
 	int i, num;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -92,7 +98,7 @@ vfs_sync(void)
 		}
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return 0;
 }
@@ -108,7 +114,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	int i, num;
 	int err=0;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -179,7 +185,7 @@ vfs_getroot(const char *devname, struct vnode **result)
 	err = ENODEV;
 
  out:
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return err;
 }
@@ -195,14 +201,14 @@ vfs_getdevname(struct fs *fs)
 
 	assert(fs != NULL);
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_read(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
 		kd = array_getguy(knowndevs, i);
 
 		if (kd->kd_fs == fs) {
-			lock_release(knowndevs_lock);
+			rwlock_release_read(knowndevs_lock);
 			/*
 			 * This is not a race condition: as long as the
 			 * guy calling us holds a reference to the fs,
@@ -213,7 +219,7 @@ vfs_getdevname(struct fs *fs)
 		}
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_read(knowndevs_lock);
 
 	return NULL;
 }
@@ -275,7 +281,7 @@ badnames(const char *n1, const char *n2, const char *n3)
 	int i, num;
 	struct knowndev *kd;
 
-	assert(lock_do_i_hold(knowndevs_lock));
+	assert(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -345,7 +351,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		volname = FSOP_GETVOLNAME(fs);
 	}
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 
 	if (!badnames(name, rawname, volname)) {
 		err = array_add(knowndevs, kd);
@@ -354,7 +360,7 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		err = EEXIST;
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 
 	return err;
 
@@ -410,7 +416,7 @@ findmount(const char *devname, struct knowndev **result)
 	struct knowndev *dev;
 	int i, num, found=0;
 
-	assert(lock_do_i_hold(knowndevs_lock));
+	assert(rwlock_do_i_hold_write(knowndevs_lock));
 
 	num = array_getnum(knowndevs);
 	for (i=0; !found && i<num; i++) {
@@ -445,7 +451,7 @@ vfs_mount(const char *devname, void *data,
 	struct fs *fs;
 	int result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 	
 
 	result = findmount(devname, &kd);
@@ -476,7 +482,7 @@ vfs_mount(const char *devname, void *data,
 	assert(result==0);
 	
  puke:
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -490,7 +496,7 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 	
 
 	result = findmount(devname, &kd);
@@ -505,6 +511,9 @@ vfs_unmount(const char *devname)
 	assert(kd->kd_rawname != NULL);
 	assert(kd->kd_device != NULL);
 
+	/* The name cache may be all that's keeping some vnodes around */
+	vfs_ncpurgefs(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto puke;
@@ -523,7 +532,7 @@ vfs_unmount(const char *devname)
 	assert(result==0);
 
  puke:
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 	return result;
 }
 
@@ -536,7 +545,7 @@ vfs_unmountall(void)
 	struct knowndev *dev;
 	int i, num, result;
 
-	lock_acquire(knowndevs_lock);
+	rwlock_acquire_write(knowndevs_lock);
 
 	num = array_getnum(knowndevs);
 	for (i=0; i<num; i++) {
@@ -552,6 +561,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		vfs_ncpurgefs(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -583,7 +594,7 @@ vfs_unmountall(void)
 		dev->kd_fs = NULL;
 	}
 
-	lock_release(knowndevs_lock);
+	rwlock_release_write(knowndevs_lock);
 
 	return 0;
 }
@@ -0,0 +1,349 @@
+/*
+ * VFS name cache.
+ *
+ * Remembers what (directory vnode, name) pairs turned into, so that
+ * looking the same name up again doesn't have to search the
+ * directory. An entry can also record that a name does not exist.
+ *
+ * Each entry holds a reference to its directory and (for a positive
+ * entry) to the vnode the name refers to, so a cached file stays
+ * loaded. Filesystems purge the affected entries whenever they add
+ * or remove a name, and vfs_unmount purges everything belonging to
+ * a filesystem before unmounting it.
+ *
+ * There is a fixed pool of entries. When it runs out, the least
+ * recently used entry is recycled. Entries are found through a hash
+ * table on the directory and the name.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+
+/* Number of entries */
+#ifndef VFS_NCSIZE
+#define VFS_NCSIZE  256
+#endif
+
+/* Number of hash chains */
+#define VFS_NCHASHSIZE  61
+
+/* Longest name we bother to cache */
+#define VFS_NCNAMELEN  31
+
+struct ncentry {
+	struct vnode *nc_dir;           /* directory; NULL if entry unused */
+	struct vnode *nc_vn;            /* what NAME is; NULL if nothing */
+	char nc_name[VFS_NCNAMELEN+1];
+	struct ncentry *nc_hashnext;
+	struct ncentry *nc_lruprev;     /* least recently used first */
+	struct ncentry *nc_lrunext;
+};
+
+static struct lock *nc_lock;
+static struct ncentry *nc_entries;
+static struct ncentry *nc_hash[VFS_NCHASHSIZE];
+static struct ncentry *nc_lruhead, *nc_lrutail;
+
+/* Statistics */
+static u_int32_t nc_hits, nc_neghits, nc_misses;
+static u_int32_t nc_enters, nc_recycles, nc_purges;
+
+////////////////////////////////////////////////////////////
+
+static
+unsigned
+nchash(struct vnode *dir, const char *name)
+{
+	unsigned h = (unsigned)(u_int32_t)dir >> 4;
+
+	while (*name) {
+		h = h*31 + (unsigned char)*name++;
+	}
+	return h % VFS_NCHASHSIZE;
+}
+
+static
+void
+lru_remove(struct ncentry *nc)
+{
+	if (nc->nc_lruprev != NULL) {
+		nc->nc_lruprev->nc_lrunext = nc->nc_lrunext;
+	}
+	else {
+		nc_lruhead = nc->nc_lrunext;
+	}
+	if (nc->nc_lrunext != NULL) {
+		nc->nc_lrunext->nc_lruprev = nc->nc_lruprev;
+	}
+	else {
+		nc_lrutail = nc->nc_lruprev;
+	}
+	nc->nc_lruprev = nc->nc_lrunext = NULL;
+}
+
+static
+void
+lru_append(struct ncentry *nc)
+{
+	nc->nc_lruprev = nc_lrutail;
+	nc->nc_lrunext = NULL;
+	if (nc_lrutail != NULL) {
+		nc_lrutail->nc_lrunext = nc;
+	}
+	else {
+		nc_lruhead = nc;
+	}
+	nc_lrutail = nc;
+}
+
+/*
+ * Put an unused entry at the head of the LRU list, to be reused first.
+ */
+static
+void
+lru_prepend(struct ncentry *nc)
+{
+	nc->nc_lruprev = NULL;
+	nc->nc_lrunext = nc_lruhead;
+	if (nc_lruhead != NULL) {
+		nc_lruhead->nc_lruprev = nc;
+	}
+	else {
+		nc_lrutail = nc;
+	}
+	nc_lruhead = nc;
+}
+
+static
+struct ncentry *
+hash_find(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+
+	for (nc = nc_hash[nchash(dir, name)]; nc != NULL;
+	     nc = nc->nc_hashnext) {
+		if (nc->nc_dir == dir && !strcmp(nc->nc_name, name)) {
+			return nc;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Take an entry out of use. Its references are handed back in *DIRP
+ * and *VNP, for the caller to drop once it has let go of nc_lock;
+ * dropping the last reference to a vnode can reclaim it, and that is
+ * not something to do while holding the cache locked.
+ */
+static
+void
+nc_release(struct ncentry *nc, struct vnode **dirp, struct vnode **vnp)
+{
+	struct ncentry **p;
+
+	assert(nc->nc_dir != NULL);
+
+	for (p = &nc_hash[nchash(nc->nc_dir, nc->nc_name)]; *p != nc;
+	     p = &(*p)->nc_hashnext) {
+		assert(*p != NULL);
+	}
+	*p = nc->nc_hashnext;
+	nc->nc_hashnext = NULL;
+
+	*dirp = nc->nc_dir;
+	*vnp = nc->nc_vn;
+	nc->nc_dir = NULL;
+	nc->nc_vn = NULL;
+
+	lru_remove(nc);
+	lru_prepend(nc);
+}
+
+static
+void
+nc_drop(struct vnode *dir, struct vnode *vn)
+{
+	if (vn != NULL) {
+		VOP_DECREF(vn);
+	}
+	if (dir != NULL) {
+		VOP_DECREF(dir);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+void
+vfs_ncbootstrap(void)
+{
+	int i;
+
+	nc_lock = lock_create("vfs ncache");
+	if (nc_lock == NULL) {
+		panic("vfs: Could not create name cache lock\n");
+	}
+
+	nc_entries = kmalloc(VFS_NCSIZE * sizeof(struct ncentry));
+	if (nc_entries == NULL) {
+		panic("vfs: Could not allocate name cache\n");
+	}
+
+	for (i=0; i<VFS_NCHASHSIZE; i++) {
+		nc_hash[i] = NULL;
+	}
+	nc_lruhead = nc_lrutail = NULL;
+	for (i=0; i<VFS_NCSIZE; i++) {
+		nc_entries[i].nc_dir = NULL;
+		nc_entries[i].nc_vn = NULL;
+		nc_entries[i].nc_hashnext = NULL;
+		lru_append(&nc_entries[i]);
+	}
+}
+
+int
+vfs_nclookup(struct vnode *dir, const char *name, struct vnode **ret)
+{
+	struct ncentry *nc;
+
+	if (strlen(name) > VFS_NCNAMELEN) {
+		return 0;
+	}
+
+	lock_acquire(nc_lock);
+	nc = hash_find(dir, name);
+	if (nc == NULL) {
+		nc_misses++;
+		lock_release(nc_lock);
+		return 0;
+	}
+
+	if (nc->nc_vn != NULL) {
+		VOP_INCREF(nc->nc_vn);
+		nc_hits++;
+	}
+	else {
+		nc_neghits++;
+	}
+	*ret = nc->nc_vn;
+
+	lru_remove(nc);
+	lru_append(nc);
+	lock_release(nc_lock);
+	return 1;
+}
+
+void
+vfs_ncenter(struct vnode *dir, const char *name, struct vnode *vn)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	if (strlen(name) > VFS_NCNAMELEN) {
+		return;
+	}
+
+	lock_acquire(nc_lock);
+
+	nc = hash_find(dir, name);
+	if (nc != NULL) {
+		/* Replace whatever we had before */
+		nc_release(nc, &olddir, &oldvn);
+	}
+
+	/* Take the least recently used entry */
+	nc = nc_lruhead;
+	assert(nc != NULL);
+	if (nc->nc_dir != NULL) {
+		assert(olddir == NULL);
+		nc_release(nc, &olddir, &oldvn);
+		nc_recycles++;
+	}
+
+	VOP_INCREF(dir);
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+	nc->nc_dir = dir;
+	nc->nc_vn = vn;
+	strcpy(nc->nc_name, name);
+
+	lru_remove(nc);
+	lru_append(nc);
+
+	nc->nc_hashnext = nc_hash[nchash(dir, name)];
+	nc_hash[nchash(dir, name)] = nc;
+	nc_enters++;
+
+	lock_release(nc_lock);
+
+	nc_drop(olddir, oldvn);
+}
+
+void
+vfs_ncpurge(struct vnode *dir, const char *name)
+{
+	struct ncentry *nc;
+	struct vnode *olddir = NULL, *oldvn = NULL;
+
+	lock_acquire(nc_lock);
+	nc = hash_find(dir, name);
+	if (nc != NULL) {
+		nc_release(nc, &olddir, &oldvn);
+		nc_purges++;
+	}
+	lock_release(nc_lock);
+
+	nc_drop(olddir, oldvn);
+}
+
+void
+vfs_ncpurgefs(struct fs *fs)
+{
+	struct vnode *olddir, *oldvn;
+	int i;
+
+	/*
+	 * Dropping references can reclaim vnodes, so do one entry at a
+	 * time and let go of the lock in between.
+	 */
+	for (i=0; i<VFS_NCSIZE; i++) {
+		olddir = oldvn = NULL;
+
+		lock_acquire(nc_lock);
+		if (nc_entries[i].nc_dir != NULL &&
+		    nc_entries[i].nc_dir->vn_fs == fs) {
+			nc_release(&nc_entries[i], &olddir, &oldvn);
+			nc_purges++;
+		}
+		lock_release(nc_lock);
+
+		nc_drop(olddir, oldvn);
+	}
+}
+
+void
+vfs_ncstats(void)
+{
+	int i, used = 0, negative = 0;
+
+	lock_acquire(nc_lock);
+	for (i=0; i<VFS_NCSIZE; i++) {
+		if (nc_entries[i].nc_dir != NULL) {
+			used++;
+			if (nc_entries[i].nc_vn == NULL) {
+				negative++;
+			}
+		}
+	}
+	kprintf("vfs name cache: %d/%d entries, %d negative\n",
+		used, VFS_NCSIZE, negative);
+	kprintf("    %u hits, %u negative hits, %u misses\n",
+		nc_hits, nc_neghits, nc_misses);
+	kprintf("    %u entered, %u recycled, %u purged\n",
+		nc_enters, nc_recycles, nc_purges);
+	lock_release(nc_lock);
+}
@@ -43,6 +43,7 @@ struct addrspace {
 #else
 	/* Put stuff here for your VM system */
 	struct array* as_regions;
+	struct rwlock *as_regionlock;	/* faults read as_regions; loads write */
 	u_int32_t permissions;	
 	vaddr_t sheap;
 	vaddr_t eheap;
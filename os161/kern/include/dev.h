@@ -2,16 +2,22 @@
 #define _DEV_H_
 
 struct uio;  /* in <uio.h> */
+struct bioreq;
 
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates which should be done.
+ *
+ * Block devices may also provide d_submit, which queues a request and
+ * returns at once (see struct bioreq below). It is NULL for devices
+ * that can only do I/O synchronously through d_io.
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_submit)(struct device *, struct bioreq *);
 
 	u_int32_t d_blocks;
 	u_int32_t d_blocksize;
@@ -19,6 +25,33 @@ struct device {
 	void *d_data;   /* device-specific data */
 };
 
+/*
+ * Asynchronous block I/O request.
+ *
+ * The caller fills in the fields down to br_arg and passes the request
+ * to d_submit. If d_submit returns 0, the request is queued, and the
+ * caller must leave it and the buffer alone until the device calls
+ * br_done with br_result set. br_done is called from the device's
+ * interrupt handler, so it must not sleep.
+ *
+ * The remaining fields belong to the driver while the request is
+ * queued.
+ */
+struct bioreq {
+	u_int32_t br_block;             /* first block */
+	u_int32_t br_nblocks;           /* number of blocks */
+	int br_write;                   /* true to write, false to read */
+	void *br_data;                  /* br_nblocks*d_blocksize bytes */
+	void (*br_done)(struct bioreq *);
+	void *br_arg;                   /* for br_done's use */
+
+	int br_result;                  /* error code, set before br_done */
+
+	struct bioreq *br_next;         /* driver queue */
+	struct bioreq *br_merged;       /* requests merged behind this one */
+	unsigned br_passed;             /* times passed over by scheduler */
+};
+
 /* Create vnode for namespace-accessible device. */
 struct vnode *dev_create_vnode(struct device *dev);
 
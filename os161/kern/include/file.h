@@ -0,0 +1,71 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and per-process file descriptor tables.
+ *
+ * A file descriptor is an index into the process's filetable. Each
+ * slot points at an openfile, which is what carries the seek offset.
+ * Descriptors inherited across fork share the same openfile, so parent
+ * and child see each other's seeks, as in Unix. The openfile goes away
+ * when the last descriptor referring to it is closed.
+ *
+ * Functions:
+ *    filetable_create  - make an empty table. Returns NULL on error.
+ *    filetable_copy    - make a table that shares every open file with
+ *                        SRC (for fork). Returns an error code.
+ *    filetable_destroy - close everything and free the table.
+ *    filetable_stdio   - open the console as descriptors 0, 1 and 2.
+ *                        Returns an error code.
+ *
+ *    file_open   - open PATH with the open(2) flags FLAGS and install
+ *                  it at the lowest free descriptor, handed back in
+ *                  RETFD. May destroy PATH. Returns an error code.
+ *    file_pipe   - make a pipe and install its read and write ends at
+ *                  the two lowest free descriptors, handed back in
+ *                  RETFDS[0] and RETFDS[1]. Returns an error code.
+ *    file_close  - close descriptor FD. Returns an error code.
+ *    file_dup2   - make descriptor NEWFD refer to the same open file as
+ *                  OLDFD, closing whatever NEWFD referred to before.
+ *                  Returns an error code.
+ *    file_get    - look up descriptor FD. Returns EBADF if it isn't
+ *                  open.
+ *
+ * of_lock serializes I/O through an openfile on a seekable object so
+ * that the offset is updated atomically with the transfer. Pipes and
+ * the console have no offset to protect and can block indefinitely,
+ * so I/O on them doesn't take it; otherwise a reader waiting for input
+ * would hold up everyone sharing the openfile. of_refcount is
+ * protected by turning interrupts off, so that dropping a reference
+ * never waits behind I/O either.
+ */
+
+#define OPEN_MAX  32	/* descriptors per process */
+
+struct vnode;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* flags given to open */
+	off_t of_offset;		/* current seek position */
+	int of_refcount;		/* descriptors sharing this */
+	int of_seekable;		/* false for pipes and the console */
+	struct lock *of_lock;
+};
+
+struct filetable {
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+struct filetable *filetable_create(void);
+int               filetable_copy(struct filetable *src, struct filetable **ret);
+void              filetable_destroy(struct filetable *ft);
+int               filetable_stdio(struct filetable *ft);
+
+int file_open(char *path, int flags, int *retfd);
+int file_pipe(int *retfds);
+int file_close(int fd);
+int file_dup2(int oldfd, int newfd);
+int file_get(int fd, struct openfile **ret);
+
+#endif /* _FILE_H_ */
@@ -2,10 +2,12 @@
 #define _KERN_SFS_H_
 
 #define SFS_MAGIC         0xabadf001    /* magic number identifying us */
+#define SFS_VERSION       2             /* on-disk format version */
 #define SFS_BLOCKSIZE     512           /* size of our blocks */
 #define SFS_VOLNAME_SIZE  32            /* max length of volume name */
 #define SFS_NDIRECT       15            /* # of direct blocks in inode */
 #define SFS_DBPERIDB      128           /* # direct blks per indirect blk */
+#define SFS_NINDIRECT     3             /* levels of indirect blocks */
 #define SFS_NAMELEN       60            /* max length of filename */
 #define SFS_SB_LOCATION    0            /* block the superblock lives in */
 #define SFS_ROOT_LOCATION  1            /* loc'n of the root dir inode */
@@ -24,6 +26,20 @@
 /* Size of bitmap (in blocks) */
 #define SFS_BITBLOCKS(nblocks)  (SFS_BITMAPSIZE(nblocks)/SFS_BLOCKBITS)
 
+/*
+ * Format versions: 1 added double and triple indirect blocks; 2 added
+ * inline data. Each only gives meaning to fields that were always
+ * zero before, so older filesystems are valid newer ones.
+ */
+#define SFS_VERSION_INDIRECT 1
+#define SFS_VERSION_INLINE 2
+
+/* Bytes of file data that fit in the inode itself */
+#define SFS_INLINESIZE    ((128-6-SFS_NDIRECT)*sizeof(u_int32_t))
+
+/* Flags for sfi_flags */
+#define SFS_IFLAG_INLINE  0x1     /* data is in sfi_inline, not blocks */
+
 /* File types for dfi_type */
 #define SFS_TYPE_INVAL    0       /* Should not appear on disk */
 #define SFS_TYPE_FILE     1
@@ -36,7 +52,8 @@ struct sfs_super {
 	u_int32_t sp_magic;       /* Magic number, should be SFS_MAGIC */
 	u_int32_t sp_nblocks;     /* Number of blocks in fs */
 	char sp_volname[SFS_VOLNAME_SIZE];  /* Name of this volume */
-	u_int32_t reserved[118];
+	u_int32_t sp_version;     /* SFS_VERSION (0 before there was one) */
+	u_int32_t reserved[117];
 };
 
 /*
@@ -48,7 +65,10 @@ struct sfs_inode {
 	u_int16_t sfi_linkcount;   /* Number of hard links to this file */
 	u_int32_t sfi_direct[SFS_NDIRECT];	/* Direct blocks */
 	u_int32_t sfi_indirect;			/* Indirect block */
-	u_int32_t sfi_waste[128-3-SFS_NDIRECT]; /* unused space */
+	u_int32_t sfi_dindirect;		/* Double indirect block */
+	u_int32_t sfi_tindirect;		/* Triple indirect block */
+	u_int32_t sfi_flags;			/* SFS_IFLAG_* above */
+	char sfi_inline[SFS_INLINESIZE];	/* Data, if SFS_IFLAG_INLINE */
 };
 
 /*
@@ -0,0 +1,20 @@
+#ifndef _KERN_SYSBATCH_H_
+#define _KERN_SYSBATCH_H_
+
+/*
+ * Request descriptor for sysbatch(). Fill in the call number and its
+ * arguments; the kernel fills in the result. sr_error is 0 on success,
+ * in which case sr_retval is what the call returned, or else the error
+ * code the call would have put in errno.
+ *
+ * fork, execv, _exit and sysbatch itself can't be batched and fail
+ * with EINVAL.
+ */
+struct sysreq {
+	int sr_callno;
+	u_int32_t sr_args[4];
+	int32_t sr_retval;
+	int sr_error;
+};
+
+#endif /* _KERN_SYSBATCH_H_ */
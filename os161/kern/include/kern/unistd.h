@@ -29,6 +29,9 @@
 #define RB_HALT       1      /* Halt system and do not reboot */
 #define RB_POWEROFF   2      /* Halt system and power off */
 
+/* Flags for waitpid */
+#define WNOHANG       1      /* Return 0 instead of blocking if no exit yet */
+
 /* Codes for lseek */
 #define SEEK_SET      0      /* Seek relative to beginning of file */
 #define SEEK_CUR      1      /* Seek relative to current position in file */
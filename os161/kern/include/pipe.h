@@ -0,0 +1,36 @@
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Anonymous pipes.
+ *
+ * A pipe is a ring buffer in kernel memory with two vnodes on it, one
+ * for each end, so that the ends can be installed in a filetable and
+ * read, written and closed like any other open file.
+ *
+ * Reads block while the pipe is empty and return 0 (EOF) once it is
+ * empty and every writer has gone. Writes block while it is full and
+ * fail with EPIPE once every reader has gone. A write of PIPE_BUF bytes
+ * or fewer waits until the whole thing fits and goes in at once, so it
+ * is never interleaved with data from another writer; larger writes
+ * are copied in as space frees up.
+ *
+ * Functions:
+ *    pipe_create - make a pipe with a SIZE-byte buffer and hand back
+ *                  the read and write ends, each already counted as
+ *                  open once. Release them with vfs_close. Returns an
+ *                  error code.
+ */
+
+#include <vm.h>
+
+/* Default buffer size; must be at least PIPE_BUF */
+#ifndef PIPE_SIZE
+#define PIPE_SIZE  PAGE_SIZE
+#endif
+
+struct vnode;
+
+int pipe_create(size_t size, struct vnode **readret, struct vnode **writeret);
+
+#endif /* _PIPE_H_ */
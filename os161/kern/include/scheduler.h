@@ -9,6 +9,10 @@
  *                     already on the run queue or sleeping, weird things
  *                     may happen. Returns an error code.
  *
+ *     scheduler_reprioritize - change the effective priority of thread T
+ *                     to PRI, moving it to the right run queue if it is
+ *                     currently runnable. Interrupts must be off.
+ *
  *     print_run_queue - dump the run queue to the console for debugging.
  *
  *     scheduler_bootstrap - initialize scheduler data 
@@ -18,10 +22,20 @@
  *                           Returns an error code.
  */
 
+/*
+ * Scheduling priorities. The scheduler always runs a thread from the
+ * highest nonempty level; threads at the same level are round-robin.
+ */
+#define PRI_MIN      0
+#define PRI_DEFAULT  4
+#define PRI_MAX      7
+#define NPRI         (PRI_MAX+1)
+
 struct thread;
 
 struct thread *scheduler(void);
 int make_runnable(struct thread *t);
+void scheduler_reprioritize(struct thread *t, int pri);
 
 void print_run_queue(void);
 
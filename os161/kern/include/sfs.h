@@ -18,16 +18,35 @@ struct sfs_vnode {
 	struct sfs_inode sv_i;		/* on-disk inode */
 	u_int32_t sv_ino;               /* inode number */
 	int sv_dirty;                   /* true if sv_i modified */
+	struct rwlock *sv_dirlock;      /* directories only: entries */
+	u_int32_t sv_ranext;            /* read-ahead: block expected next */
+	u_int32_t sv_rawindow;          /* read-ahead: blocks to stay ahead */
+	u_int32_t sv_raend;             /* read-ahead: first block not asked for */
+	u_int32_t sv_prestart;          /* first block reserved for growth */
+	u_int32_t sv_npre;              /* number of blocks reserved */
+	struct sfs_vnode *sv_hashnext;  /* next in sfs_vnhash chain */
+	struct sfs_vnode *sv_dirtyprev; /* list of vnodes with sv_dirty set */
+	struct sfs_vnode *sv_dirtynext;
 };
 
+/* Number of chains in the table of loaded vnodes */
+#ifndef SFS_VNHASHSIZE
+#define SFS_VNHASHSIZE  251
+#endif
+
 struct sfs_fs {
 	struct fs sfs_absfs;            /* abstract filesystem structure */
 	struct sfs_super sfs_super;	/* on-disk superblock */
 	int sfs_superdirty;             /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
-	struct array *sfs_vnodes;       /* vnodes loaded into memory */
+	struct sfs_vnode *sfs_vnhash[SFS_VNHASHSIZE]; /* loaded vnodes */
+	int sfs_nvnodes;                /* number of vnodes loaded */
+	struct sfs_vnode *sfs_dirtyvn;  /* loaded vnodes with sv_dirty set */
+	u_int32_t sfs_vnlookups;        /* stats: vnode table lookups */
+	u_int32_t sfs_vnprobes;         /* stats: chain entries examined */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	int sfs_freemapdirty;           /* true if freemap modified */
+	u_int32_t sfs_allochint;        /* where to look for free blocks next */
 };
 
 /*
@@ -44,12 +63,78 @@ int sfs_mount(const char *device);
 #define SFSUIO(uio, ptr, block, rw) \
     mk_kuio(uio, ptr, SFS_BLOCKSIZE, ((off_t)(block))*SFS_BLOCKSIZE, rw)
 
-/* Convenience functions for block I/O */
+/*
+ * Block I/O. sfs_rwblock goes straight to the device; sfs_rblock and
+ * sfs_wblock copy through the buffer cache.
+ */
 int sfs_rwblock(struct sfs_fs *sfs, struct uio *uio);
 int sfs_rblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 int sfs_wblock(struct sfs_fs *sfs, void *data, u_int32_t block);
 
+/*
+ * Block buffer cache (sfs_cache.c).
+ *
+ * Blocks are cached by (device, block number). A buffer handed out by
+ * sfs_bread or sfs_bget is busy: the caller has it to itself, and may
+ * use b_data, until it calls sfs_brelse. Anyone else asking for the
+ * same block waits until then. Modified buffers are written back to
+ * disk later, by a flusher thread or when the cache needs room.
+ *
+ *    sfs_bootstrap   - set up the cache and start the flusher thread.
+ *                      Called once at boot.
+ *    sfs_bread       - get the buffer for BLOCK with its contents read
+ *                      in.
+ *    sfs_bget        - get the buffer for BLOCK without reading it, for
+ *                      callers that are about to overwrite all of it.
+ *    sfs_bfill       - read whichever of the N blocks from BLOCK aren't
+ *                      cached yet, with as few transfers as possible.
+ *    sfs_bprefetch   - start reading BLOCK into the cache in the
+ *                      background, unless it's already there. Just a
+ *                      hint; may be ignored.
+ *    sfs_bdirty      - note that a busy buffer has been modified.
+ *    sfs_brelse      - let go of a busy buffer.
+ *    sfs_bflushblock - write BLOCK to disk now if it is dirty.
+ *    sfs_bflush      - write every dirty block belonging to SFS to disk.
+ *    sfs_binval      - drop every cached block belonging to SFS, for
+ *                      unmount. None may be busy or dirty.
+ *    sfs_bstats      - print hit, miss and write-back counts.
+ */
+struct sfs_buf {
+	struct sfs_fs *b_fs;            /* filesystem doing I/O on it */
+	struct device *b_dev;           /* device the block is on */
+	u_int32_t b_block;              /* block number on that device */
+	void *b_data;                   /* SFS_BLOCKSIZE bytes */
+	int b_valid;                    /* true if b_data holds the block */
+	int b_busy;                     /* true if someone is using it */
+	int b_refcount;                 /* user plus threads waiting */
+	int b_dirty;                    /* true if newer than the disk */
+	time_t b_dirtysecs;             /* when it became dirty */
+	struct sfs_buf *b_hashnext;
+	struct sfs_buf *b_lruprev;      /* LRU list of idle buffers */
+	struct sfs_buf *b_lrunext;
+	struct sfs_buf *b_dirtyprev;    /* dirty list, oldest first */
+	struct sfs_buf *b_dirtynext;
+};
+
+void sfs_bootstrap(void);
+int  sfs_bread(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+int  sfs_bget(struct sfs_fs *sfs, u_int32_t block, struct sfs_buf **ret);
+void sfs_bfill(struct sfs_fs *sfs, u_int32_t block, u_int32_t n);
+void sfs_bprefetch(struct sfs_fs *sfs, u_int32_t block);
+void sfs_bdirty(struct sfs_buf *b);
+void sfs_brelse(struct sfs_buf *b);
+int  sfs_bflushblock(struct sfs_fs *sfs, u_int32_t block);
+int  sfs_bflush(struct sfs_fs *sfs);
+void sfs_binval(struct sfs_fs *sfs);
+void sfs_bstats(void);
+
 /* Get root vnode */
 struct vnode *sfs_getroot(struct fs *fs);
 
+/*
+ * Print statistics about the table of loaded vnodes of the sfs that
+ * V is on. Returns EINVAL if V isn't an sfs vnode.
+ */
+int sfs_vnstats(struct vnode *v);
+
 #endif /* _SFS_H_ */
@@ -5,6 +5,8 @@
 #ifndef _SYNCH_H_
 #define _SYNCH_H_
 
+#include <threadlist.h>
+
 /*
  * Dijkstra-style semaphore.
  * Operations:
@@ -44,6 +46,21 @@ void              sem_destroy(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
+ * Waiters queue up FIFO on the lock itself. lock_release hands the
+ * lock directly to the highest-priority waiter (the first one among
+ * equals) instead of waking everybody up to race for it, so a release
+ * costs at most one wakeup.
+ *
+ * Locks do priority inheritance: while a thread waits for a lock, the
+ * holder runs at least at the waiter's priority, and so on down the
+ * chain if the holder is itself waiting for another lock. The holder
+ * drops back when it releases.
+ *
+ *    lock_propagate_priority - recompute thread T's effective priority
+ *                   from its base priority and the waiters on the locks
+ *                   it holds, and pass any change on to whoever holds
+ *                   the lock T is waiting for. Interrupts must be off.
+ *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
@@ -52,7 +69,8 @@ struct lock {
 	char *name;
 	volatile struct thread* threadHolder;
 	volatile int isHeld; 
-	
+	struct threadlist waiters;	/* threads blocked in lock_acquire */
+	struct lock *l_heldnext;	/* holder's list of held locks */
 };
 
 struct lock *lock_create(const char *name);
@@ -60,6 +78,7 @@ void         lock_acquire(struct lock *);
 void         lock_release(struct lock *);
 int          lock_do_i_hold(struct lock *);
 void         lock_destroy(struct lock *);
+void         lock_propagate_priority(struct thread *t);
 
 
 /*
@@ -84,13 +103,16 @@ void         lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
+ * Each CV keeps its own queue of waiters, so cv_signal wakes exactly
+ * one thread (the longest waiting) in constant time.
+ *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
  */
 
 struct cv {
 	char *name;
-	volatile struct lock* lock_hold;
+	struct threadlist waiters;	/* threads blocked in cv_wait */
 };
 
 struct cv *cv_create(const char *name);
@@ -99,4 +121,46 @@ void       cv_signal(struct cv *cv, struct lock *lock);
 void       cv_broadcast(struct cv *cv, struct lock *lock);
 void       cv_destroy(struct cv *);
 
+
+/*
+ * Reader-writer lock.
+ *
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock shared. Any number of readers
+ *                           can hold it at once.
+ *    rwlock_release_read  - Drop a shared hold.
+ *    rwlock_acquire_write - Get the lock exclusive: no readers and no
+ *                           other writer.
+ *    rwlock_release_write - Drop the exclusive hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock exclusive; false otherwise.
+ *
+ * Writers have preference: once a writer is waiting, new readers queue
+ * up behind it instead of piling on. Readers can't starve either,
+ * because when a writer releases, every reader waiting at that point
+ * is let in together before the next writer gets a turn. As with
+ * locks, the lock is handed over directly to whoever is woken.
+ *
+ * There is no priority inheritance through rwlocks.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+
+struct rwlock {
+	char *name;
+	volatile int rw_readers;		/* number of readers inside */
+	volatile struct thread *rw_writer;	/* writer inside, if any */
+	struct threadlist rw_readwait;		/* readers waiting to get in */
+	struct threadlist rw_writewait;		/* writers waiting to get in */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void           rwlock_acquire_read(struct rwlock *);
+void           rwlock_release_read(struct rwlock *);
+void           rwlock_acquire_write(struct rwlock *);
+void           rwlock_release_write(struct rwlock *);
+int            rwlock_do_i_hold_write(struct rwlock *);
+void           rwlock_destroy(struct rwlock *);
+
 #endif /* _SYNCH_H_ */
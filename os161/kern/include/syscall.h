@@ -11,14 +11,25 @@ typedef struct curTime {
 } curTime;
 
 int sys_reboot(int code);
-int syscall_read(int fd, char* buf, size_t buflen, int32_t *retval);
-int syscall_write(int fd, char* c, size_t size, int32_t* retval);
+int syscall_open(userptr_t path, int flags, int32_t *retval);
+int syscall_close(int fd);
+int syscall_read(int fd, userptr_t buf, size_t buflen, int32_t *retval);
+int syscall_write(int fd, userptr_t buf, size_t size, int32_t* retval);
+int syscall_lseek(int fd, off_t pos, int whence, int32_t *retval);
+int syscall_pipe(userptr_t fds, int32_t *retval);
+int syscall_dup2(int oldfd, int newfd, int32_t *retval);
 int syscall_fork(struct trapframe *, int32_t *retval);
-int syscall_waitpid(int childPID, int status, int options, int32_t *retval);
+int syscall_waitpid(int childPID, userptr_t status, int options, int32_t *retval);
 int syscall_getpid(int32_t *retval);
-int syscall__exit(int , int32_t *retval);
-// int sys_execv(char *progname, char **args);
-int syscall_execv(const char *prog_path, char **args);
+int syscall_exit(int exitcode, int32_t *retval);
+int syscall_execv(userptr_t path, userptr_t args);
+int syscall_spawn(userptr_t path, userptr_t args, int32_t *retval);
+int syscall_batch(userptr_t reqs, int nreqs, int32_t *retval);
 int syscall_sbrk(int incr, int32_t* retval);
 int syscall_time(time_t *seconds, unsigned long *nanoseconds, int *retval);
+
+/* Per-syscall call, error and time counters (see mips_syscall) */
+void syscall_printstats(void);
+void syscall_resetstats(void);
+
 #endif /* _SYSCALL_H_ */
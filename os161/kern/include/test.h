@@ -27,6 +27,8 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int pritest(int, char **);
 
 /* filesystem tests */
 int fstest(int, char **);
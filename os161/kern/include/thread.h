@@ -8,11 +8,25 @@
 /* Get machine-dependent stuff */
 #include <machine/pcb.h>
 #include <synch.h>
+#include <threadlist.h>
 
 #define MAX_PID 512
 #define MIN_PID 1 
 #define MAX_ARG_LEN 256
 
+/*
+ * Default limit on the number of live (not yet reaped) processes.
+ * Must be less than MAX_PID. Can be changed at runtime with
+ * proc_setlimit (the "plimit" menu command).
+ */
+#define PROC_LIMIT 256
+
+/* parentID of a process nobody will ever wait for */
+#define NO_PARENT -1
+
+/* Marks the end of a child/sibling list (PID 0 is never handed out) */
+#define NO_PID 0
+
 struct addrspace;
 struct semaphore* lock;
 typedef struct PROC_CONTROL_BLOCK {
@@ -21,12 +35,23 @@ typedef struct PROC_CONTROL_BLOCK {
 	struct thread* processThread;
 	int parentID;
 	int waited;
+
+	/* Children of this process, linked through the sibling fields */
+	int firstChild;
+	int nextSibling;
+	int prevSibling;
+
+	/* Completion object: the parent sleeps here until we exit */
+	struct threadlist exitWaiters;
 } procContBlock;
  
 procContBlock* listProcesses [MAX_PID];
 
 int assign_pID(unsigned int * to_pid);
 void processRemove(u_int32_t pID);
+void proc_orphan_children(u_int32_t pID);
+int proc_setlimit(int limit);
+int proc_wait(int pID, int options, procContBlock **ret);
 
 struct thread {
 	/**********************************************************/
@@ -36,7 +61,13 @@ struct thread {
 	struct pcb t_pcb;
 	char *t_name;
 	const void *t_sleepaddr;
+	struct thread *t_waitnext;	/* link for threadlist sleepers */
 	char *t_stack;
+	int t_basepri;			/* priority we were given */
+	int t_pri;			/* effective priority (>= t_basepri) */
+	int t_runpri;			/* run queue we're on, or -1 */
+	struct lock *t_blockedon;	/* lock we're waiting for, if any */
+	struct lock *t_heldlocks;	/* locks we hold, via l_heldnext */
 	u_int32_t pID;
 
 	/**********************************************************/
@@ -55,7 +86,11 @@ struct thread {
 	 */
 	struct vnode *t_cwd;
 
-	struct semaphore *wait;
+	/*
+	 * Open file descriptors (user processes only; NULL for pure
+	 * kernel threads). Copied on fork and cleaned up in thread_exit.
+	 */
+	struct filetable *t_filetable;
 };
 
 /* Call once during STARTUP to allocate data structures. */
@@ -76,6 +111,12 @@ void thread_shutdown(void);
  * the parent thread should be done only with caution, because in
  * general the child thread might exit at any time.) Returns an error
  * code.
+ *
+ * If "ret" is null the caller has no way to wait for the new thread,
+ * so it gets no parent and its PID is given back as soon as it exits.
+ * Kernel threads (tests, the sfs flusher and read-ahead threads) are
+ * made this way; otherwise each would stay a zombie forever, counted
+ * against the process limit.
  */
 int thread_fork(const char *name, 
 		void *data1, unsigned long data2, 
@@ -103,6 +144,13 @@ void thread_yield(void);
  */
 void thread_sleep(const void *addr);
 
+/*
+ * Set the base scheduling priority of thread T (PRI_MIN..PRI_MAX, see
+ * scheduler.h). T may run higher while it holds a lock that a
+ * higher-priority thread wants. Returns an error code.
+ */
+int thread_setpriority(struct thread *t, int pri);
+
 void thread_join(struct thread *);
 
 void thread_detach(struct thread *);
@@ -112,7 +160,6 @@ void thread_detach(struct thread *);
  * Interrupts must be disabled.
  */
 void thread_wakeup(const void *addr);
-void thread_wakeup_1(const void *addr);
 
 /*
  * Return nonzero if there are any threads sleeping on the specified
@@ -0,0 +1,41 @@
+#ifndef _THREADLIST_H_
+#define _THREADLIST_H_
+
+/*
+ * Queue of threads sleeping on one particular object.
+ *
+ * Unlike thread_sleep, which parks the thread in the global table of
+ * sleepers keyed by address, a thread sleeping on a threadlist is
+ * linked into the list itself (through t_waitnext). Waking the first
+ * waiter is therefore O(1) no matter how many other threads are
+ * asleep, and nothing else can be woken by accident.
+ *
+ * Operations (all must be called with interrupts off):
+ *    threadlist_init    - set up an empty list.
+ *    threadlist_isempty - return true if no thread is waiting.
+ *    thread_sleep_on    - put the current thread to sleep at the tail
+ *                         of the list.
+ *    thread_wakeone     - make the thread at the head of the list
+ *                         runnable and hand it back (NULL if none).
+ *    thread_wakeall     - make every thread on the list runnable.
+ *    thread_wakebest    - like thread_wakeone, but take the
+ *                         highest-priority waiter (the earliest one
+ *                         among equals).
+ */
+
+struct thread;
+
+struct threadlist {
+	struct thread *tl_head;
+	struct thread *tl_tail;
+	int tl_count;
+};
+
+void           threadlist_init(struct threadlist *tl);
+int            threadlist_isempty(struct threadlist *tl);
+void           thread_sleep_on(struct threadlist *tl);
+struct thread *thread_wakeone(struct threadlist *tl);
+void           thread_wakeall(struct threadlist *tl);
+struct thread *thread_wakebest(struct threadlist *tl);
+
+#endif /* _THREADLIST_H_ */
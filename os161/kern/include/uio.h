@@ -83,4 +83,10 @@ int uiomovezeros(size_t len, struct uio *uio);
  */
 void mk_kuio(struct uio *, void *kbuf, size_t len, off_t pos, enum uio_rw rw);
 
+/*
+ * Initialize uio for I/O from a user buffer in the current process.
+ */
+void mk_uuio(struct uio *, userptr_t ubuf, size_t len, off_t pos,
+	     enum uio_rw rw);
+
 #endif /* _UIO_H_ */
@@ -81,6 +81,33 @@ int vfs_rename(char *oldpath, char *newpath);
 int vfs_chdir(char *path);
 int vfs_getcwd(struct uio *buf);
 
+/*
+ * Name cache (vfsncache.c), for filesystems to use in their lookup
+ * routines. Entries map a directory vnode and a name within it to the
+ * vnode the name refers to, or to nothing if the name doesn't exist.
+ * A filesystem must purge the entry for a name whenever it adds or
+ * removes that name.
+ *
+ *    vfs_ncbootstrap - set up the cache. (Called from vfs_bootstrap.)
+ *    vfs_nclookup    - look up NAME in DIR. Returns 1 if the cache
+ *                      knows the answer, with the vnode (incref'd) or
+ *                      NULL if there's no such name in RET; returns 0
+ *                      if it doesn't know.
+ *    vfs_ncenter     - remember that NAME in DIR is VN, or that it
+ *                      doesn't exist if VN is NULL.
+ *    vfs_ncpurge     - forget NAME in DIR.
+ *    vfs_ncpurgefs   - forget everything on FS, letting go of the
+ *                      vnodes the cache was holding. (For unmount.)
+ *    vfs_ncstats     - print hit and miss counts.
+ */
+
+void vfs_ncbootstrap(void);
+int  vfs_nclookup(struct vnode *dir, const char *name, struct vnode **ret);
+void vfs_ncenter(struct vnode *dir, const char *name, struct vnode *vn);
+void vfs_ncpurge(struct vnode *dir, const char *name);
+void vfs_ncpurgefs(struct fs *fs);
+void vfs_ncstats(void);
+
 /*
  * Misc
  *
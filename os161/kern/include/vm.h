@@ -16,6 +16,7 @@ struct C_ENTRY {
 	paddr_t p_as; 
 	vaddr_t v_as; 
 	int length; 
+	int refcount;	// page loans pinning this frame
 };
 
 /* Fault-type arguments to vm_fault() */
@@ -49,4 +50,13 @@ void check_levels(vaddr_t faultaddress, paddr_t* paddr);
 paddr_t alloc_page_userspace(struct addrspace * as, vaddr_t v_as);
 int c_entry_freed_state();
 
+/*
+ * Page loaning. vm_loanpage pins the resident frame behind user
+ * address VA in the current address space and returns its physical
+ * address, or 0 if the page isn't resident. A pinned frame survives
+ * as_destroy; the vm_unloanpage that drops the last pin frees it.
+ */
+paddr_t vm_loanpage(vaddr_t va);
+void vm_unloanpage(paddr_t pa);
+
 #endif /* _VM_H_ */
\ No newline at end of file
@@ -69,30 +69,66 @@ bitmap_getdata(struct bitmap *b)
 	return b->v;
 }
 
+/*
+ * Find a cleared bit from START up to (not including) END, set it, and
+ * return its index. Full stretches are skipped a u_int32_t at a time
+ * where alignment allows, and a word at a time otherwise; comparing
+ * against all ones doesn't care about byte order, so this is safe
+ * despite the above.
+ */
+static
 int
-bitmap_alloc(struct bitmap *b, u_int32_t *index)
+bitmap_scan(struct bitmap *b, u_int32_t start, u_int32_t end,
+	    u_int32_t *index)
 {
-	u_int32_t ix;
-	u_int32_t maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
-	u_int32_t offset;
+	const u_int32_t bigbits = sizeof(u_int32_t)*BITS_PER_WORD;
+	u_int32_t bit, ix;
+	WORD_TYPE mask;
+
+	bit = start;
+	while (bit < end) {
+		ix = bit / BITS_PER_WORD;
+
+		if (bit % bigbits == 0 && bit + bigbits <= end &&
+		    *(u_int32_t *)&b->v[ix] == 0xffffffff) {
+			bit += bigbits;
+			continue;
+		}
+		if (bit % BITS_PER_WORD == 0 && bit + BITS_PER_WORD <= end &&
+		    b->v[ix] == WORD_ALLBITS) {
+			bit += BITS_PER_WORD;
+			continue;
+		}
 
-	for (ix=0; ix<maxix; ix++) {
-		if (b->v[ix]!=WORD_ALLBITS) {
-			for (offset = 0; offset < BITS_PER_WORD; offset++) {
-				WORD_TYPE mask = ((WORD_TYPE)1)<<offset;
-				if ((b->v[ix] & mask)==0) {
-					b->v[ix] |= mask;
-					*index = (ix*BITS_PER_WORD)+offset;
-					assert(*index < b->nbits);
-					return 0;
-				}
-			}
-			assert(0);
+		mask = ((WORD_TYPE)1) << (bit % BITS_PER_WORD);
+		if ((b->v[ix] & mask)==0) {
+			b->v[ix] |= mask;
+			*index = bit;
+			return 0;
 		}
+		bit++;
 	}
 	return ENOSPC;
 }
 
+int
+bitmap_alloc(struct bitmap *b, u_int32_t *index)
+{
+	return bitmap_scan(b, 0, b->nbits, index);
+}
+
+int
+bitmap_alloc_near(struct bitmap *b, u_int32_t goal, u_int32_t *index)
+{
+	if (goal >= b->nbits) {
+		goal = 0;
+	}
+	if (bitmap_scan(b, goal, b->nbits, index)==0) {
+		return 0;
+	}
+	return bitmap_scan(b, 0, goal, index);
+}
+
 static
 inline
 void
@@ -2,23 +2,10 @@
 #include <lib.h>
 
 /*
- * Do a backspace in typed input.
- * We overwrite the current character with a space in case we're on
- * a terminal where backspace is nondestructive.
- */
-static
-void
-backsp(void)
-{
-	putch('\b');
-	putch(' ');
-	putch('\b');
-}
-
-/*
- * Read a string off the console. Support a few of the more useful
- * common control characters. Do not include the terminating newline
- * in the buffer passed back.
+ * Read a string off the console. Echo and line editing (backspace,
+ * ^U, ^W, ^R, ^C) are done by the console's line discipline, so all
+ * we get back are completed lines. Do not include the terminating
+ * newline in the buffer passed back; truncate lines that don't fit.
  */
 void
 kgets(char *buf, size_t maxlen)
@@ -28,55 +15,12 @@ kgets(char *buf, size_t maxlen)
 
 	while (1) {
 		ch = getch();
-		if (ch=='\n' || ch=='\r') {
-			putch('\n');
+		if (ch=='\n') {
 			break;
 		}
-
-		/* Only allow the normal 7-bit ascii */
-		if (ch>=32 && ch<127 && pos < maxlen-1) {
-			putch(ch);
+		if (pos < maxlen-1) {
 			buf[pos++] = ch;
 		}
-		else if ((ch=='\b' || ch==127) && pos>0) {
-			/* backspace */
-			backsp();
-			pos--;
-		}
-		else if (ch==3) {
-			/* ^C - return empty string */
-			putch('^');
-			putch('C');
-			putch('\n');
-			pos = 0;
-			break;
-		}
-		else if (ch==18) {
-			/* ^R - reprint input */
-			buf[pos] = 0;
-			kprintf("^R\n%s", buf);
-		}
-		else if (ch==21) {
-			/* ^U - erase line */
-			while (pos > 0) {
-				backsp();
-				pos--;
-			}
-		}
-		else if (ch==23) {
-			/* ^W - erase word */
-			while (pos > 0 && buf[pos-1]==' ') {
-				backsp();
-				pos--;
-			}
-			while (pos > 0 && buf[pos-1]!=' ') {
-				backsp();
-				pos--;
-			}
-		}
-		else {
-			beep();
-		}
 	}
 
 	buf[pos] = 0;
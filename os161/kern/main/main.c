@@ -13,10 +13,12 @@
 #include <scheduler.h>
 #include <dev.h>
 #include <vfs.h>
+#include <sfs.h>
 #include <vm.h>
 #include <syscall.h>
 #include <version.h>
 #include <hello.h>
+#include "opt-sfs.h"
 
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -75,6 +77,9 @@ boot(void)
 	scheduler_bootstrap();
 	thread_bootstrap();
 	vfs_bootstrap();
+#if OPT_SFS
+	sfs_bootstrap();
+#endif
 	dev_bootstrap();
 	vm_bootstrap();
 	kprintf_bootstrap();
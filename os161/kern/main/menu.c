@@ -8,7 +8,10 @@
 #include <kern/limits.h>
 #include <lib.h>
 #include <clock.h>
+#include <machine/spl.h>
 #include <thread.h>
+#include <scheduler.h>
+#include <curthread.h>
 #include <syscall.h>
 #include <uio.h>
 #include <vfs.h>
@@ -103,8 +106,13 @@ common_prog(int nargs, char **args)
 		kprintf("thread_fork failed: %s\n", strerror(result));
 		return result;
 	}
-	int ret;
-	syscall_waitpid(temp->pID, 0, 0, &ret);
+	/* Wait for the program and reap it */
+	int spl = splhigh();
+	procContBlock *pcb;
+	if (proc_wait(temp->pID, 0, &pcb) == 0) {
+		processRemove(temp->pID);
+	}
+	splx(spl);
 	return 0;
 }
 
@@ -342,6 +350,120 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+/*
+ * Command for printing (or, with "reset", zeroing) the syscall counters.
+ */
+static
+int
+cmd_syscallstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		syscall_resetstats();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: sc [reset]\n");
+		return EINVAL;
+	}
+
+	syscall_printstats();
+	return 0;
+}
+
+/*
+ * Command for printing name cache statistics.
+ */
+static
+int
+cmd_ncachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vfs_ncstats();
+	return 0;
+}
+
+#if OPT_SFS
+static
+int
+cmd_bcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	sfs_bstats();
+	return 0;
+}
+
+/*
+ * Command for printing the vnode table statistics of a mounted sfs.
+ */
+static
+int
+cmd_vnstats(int nargs, char **args)
+{
+	char *device;
+	struct vnode *root;
+	int result;
+
+	if (nargs != 2) {
+		kprintf("Usage: vn device:\n");
+		return EINVAL;
+	}
+
+	device = args[1];
+
+	/* Allow (but do not require) colon after device name */
+	if (device[strlen(device)-1]==':') {
+		device[strlen(device)-1] = 0;
+	}
+
+	result = vfs_getroot(device, &root);
+	if (result) {
+		return result;
+	}
+	result = sfs_vnstats(root);
+	if (result) {
+		kprintf("vn: %s is not an sfs filesystem\n", device);
+	}
+	VOP_DECREF(root);
+	return result;
+}
+#endif
+
+/*
+ * Command for changing the limit on the number of live processes.
+ */
+static
+int
+cmd_plimit(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: plimit nprocs\n");
+		return EINVAL;
+	}
+
+	return proc_setlimit(atoi(args[1]));
+}
+
+/*
+ * Command for changing the priority of the menu thread. Threads it
+ * forks afterwards, such as programs run with "p", start out at the
+ * same priority.
+ */
+static
+int
+cmd_pri(int nargs, char **args)
+{
+	if (nargs != 2) {
+		kprintf("Usage: pri priority (%d-%d)\n", PRI_MIN, PRI_MAX);
+		return EINVAL;
+	}
+
+	return thread_setpriority(curthread, atoi(args[1]));
+}
+
 static
 void
 showmenu(const char *name, const char *x[])
@@ -378,6 +500,8 @@ static const char *opsmenu[] = {
 	"[cd]      Change directory          ",
 	"[pwd]     Print current directory   ",
 	"[sync]    Sync filesystems          ",
+	"[plimit]  Set process limit         ",
+	"[pri]     Set menu thread priority  ",
 	"[panic]   Intentional panic         ",
 	"[q]       Quit and shut down        ",
 	NULL
@@ -409,6 +533,8 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Rwlock test           (1)     ",
+	"[sy5] Priority inheritance test     ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress        (4)     ",
 	"[fs3] FS write stress       (4)     ",
@@ -443,6 +569,12 @@ static const char *mainmenu[] = {
 	"[1c] Stoplight                      ",
 #endif
 	"[kh] Kernel heap stats              ",
+	"[sc] System call stats              ",
+	"[nc] Name cache stats               ",
+#if OPT_SFS
+	"[bc] SFS buffer cache stats         ",
+	"[vn] SFS vnode table stats          ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -542,6 +674,8 @@ static struct {
 	{ "cd",		cmd_chdir },
 	{ "pwd",	cmd_pwd },
 	{ "sync",	cmd_sync },
+	{ "plimit",	cmd_plimit },
+	{ "pri",	cmd_pri },
 	{ "panic",	cmd_panic },
 	{ "q",		cmd_quit },
 	{ "exit",	cmd_quit },
@@ -556,6 +690,12 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "sc",         cmd_syscallstats },
+	{ "nc",         cmd_ncachestats },
+#if OPT_SFS
+	{ "bc",         cmd_bcachestats },
+	{ "vn",         cmd_vnstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -574,6 +714,8 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	pritest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -1,4 +1,5 @@
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
@@ -11,7 +12,7 @@ bitmaptest(int nargs, char **args)
 	struct bitmap *b;
 	char data[TESTSIZE];
 	u_int32_t x;
-	int i;
+	int i, result;
 
 	(void)nargs;
 	(void)args;
@@ -72,6 +73,23 @@ bitmaptest(int nargs, char **args)
 		assert(data[i]==0);
 	}
 
+	/* Free a few bits and make sure alloc_near finds the right ones */
+	bitmap_unmark(b, 3);
+	bitmap_unmark(b, 100);
+	bitmap_unmark(b, 101);
+	bitmap_unmark(b, TESTSIZE-1);
+
+	result = bitmap_alloc_near(b, 50, &x);
+	assert(result==0 && x==100);
+	result = bitmap_alloc_near(b, 101, &x);
+	assert(result==0 && x==101);
+	result = bitmap_alloc_near(b, 102, &x);
+	assert(result==0 && x==TESTSIZE-1);
+	result = bitmap_alloc_near(b, 102, &x);
+	assert(result==0 && x==3);
+	result = bitmap_alloc_near(b, TESTSIZE, &x);
+	assert(result==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
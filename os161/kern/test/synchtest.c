@@ -6,12 +6,17 @@
 #include <lib.h>
 #include <synch.h>
 #include <thread.h>
+#include <threadlist.h>
+#include <scheduler.h>
+#include <curthread.h>
 #include <test.h>
 #include <clock.h>
+#include <machine/spl.h>
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
 #define NCVLOOPS      5
+#define NRWLOOPS      40
 #define NTHREADS      32
 
 static volatile unsigned long testval1;
@@ -20,6 +25,7 @@ static volatile unsigned long testval3;
 static struct semaphore *testsem;
 static struct lock *testlock;
 static struct cv *testcv;
+static struct rwlock *testrw;
 static struct semaphore *donesem;
 
 static
@@ -44,6 +50,12 @@ inititems(void)
 			panic("synchtest: cv_create failed\n");
 		}
 	}
+	if (testrw==NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
 	if (donesem==NULL) {
 		donesem = sem_create("donesem", 0);
 		if (donesem == NULL) {
@@ -273,3 +285,187 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Reader-writer lock test. One thread in four is a writer. Writers
+ * must find the lock empty and must not see anybody else's values;
+ * readers must see a consistent set of values. Everybody yields while
+ * inside so that readers get a chance to overlap.
+ */
+
+static volatile int rwreaders;
+static volatile int rwmaxreaders;
+static volatile int rwfailures;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	int spl = splhigh();
+	kprintf("thread %lu: Mismatch on %s\n", num, msg);
+	rwfailures++;
+	splx(spl);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i, spl;
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		if (num % 4 == 0) {
+			rwlock_acquire_write(testrw);
+			if (rwreaders != 0) {
+				rwfail(num, "readers inside with writer");
+			}
+			testval1 = num;
+			testval2 = num*num;
+			thread_yield();
+			if (testval1 != num || testval2 != num*num) {
+				rwfail(num, "writer values");
+			}
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spl = splhigh();
+			rwreaders++;
+			if (rwreaders > rwmaxreaders) {
+				rwmaxreaders = rwreaders;
+			}
+			splx(spl);
+
+			if (testval2 != testval1*testval1) {
+				rwfail(num, "testval2/testval1");
+			}
+			thread_yield();
+			if (testval2 != testval1*testval1) {
+				rwfail(num, "testval2/testval1 after yield");
+			}
+
+			spl = splhigh();
+			rwreaders--;
+			splx(spl);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(donesem);
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting rwlock test...\n");
+
+	testval1 = testval2 = 0;
+	rwreaders = rwmaxreaders = rwfailures = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("synchtest", NULL, i, rwtestthread,
+				     NULL);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("Up to %d readers inside at once\n", rwmaxreaders);
+	if (rwfailures > 0 || rwmaxreaders < 2) {
+		kprintf("Test failed\n");
+	}
+
+	kprintf("Rwlock test done.\n");
+
+	return 0;
+}
+
+static volatile int pri_boosted;
+static volatile int pri_after;
+
+static
+void
+pritestlow(void *junk, unsigned long num)
+{
+	int spl, waiting;
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(curthread, PRI_MIN);
+	lock_acquire(testlock);
+	V(donesem);
+
+	/* Hang onto the lock until the high-priority thread wants it */
+	do {
+		thread_yield();
+		spl = splhigh();
+		waiting = !threadlist_isempty(&testlock->waiters);
+		splx(spl);
+	} while (!waiting);
+
+	pri_boosted = curthread->t_pri;
+	lock_release(testlock);
+	pri_after = curthread->t_pri;
+	V(donesem);
+}
+
+static
+void
+pritesthigh(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setpriority(curthread, PRI_MAX);
+	lock_acquire(testlock);
+	lock_release(testlock);
+	V(donesem);
+}
+
+int
+pritest(int nargs, char **args)
+{
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting priority inheritance test...\n");
+
+	pri_boosted = pri_after = -1;
+
+	result = thread_fork("pritest low", NULL, 0, pritestlow, NULL);
+	if (result) {
+		panic("pritest: thread_fork failed: %s\n", strerror(result));
+	}
+	/* Wait until it holds the lock */
+	P(donesem);
+
+	result = thread_fork("pritest high", NULL, 0, pritesthigh, NULL);
+	if (result) {
+		panic("pritest: thread_fork failed: %s\n", strerror(result));
+	}
+	P(donesem);
+	P(donesem);
+
+	kprintf("Holder ran at %d while waited on, %d after release\n",
+		pri_boosted, pri_after);
+	if (pri_boosted != PRI_MAX || pri_after != PRI_MIN) {
+		kprintf("Test failed\n");
+	}
+
+	kprintf("Priority inheritance test done.\n");
+
+	return 0;
+}
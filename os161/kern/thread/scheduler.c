@@ -1,8 +1,8 @@
 /*
  * Scheduler.
  *
- * The default scheduler is very simple, just a round-robin run queue.
- * You'll want to improve it.
+ * Strict priority scheduling: one round-robin run queue per priority
+ * level, and the highest nonempty level always goes first.
  */
 
 #include <types.h>
@@ -16,8 +16,8 @@
  *  Scheduler data
  */
 
-// Queue of runnable threads
-static struct queue *runqueue;
+// Queues of runnable threads, one per priority level
+static struct queue *runqueues[NPRI];
 
 /*
  * Setup function
@@ -25,9 +25,13 @@ static struct queue *runqueue;
 void
 scheduler_bootstrap(void)
 {
-	runqueue = q_create(32);
-	if (runqueue == NULL) {
-		panic("scheduler: Could not create run queue\n");
+	int i;
+
+	for (i=0; i<NPRI; i++) {
+		runqueues[i] = q_create(32);
+		if (runqueues[i] == NULL) {
+			panic("scheduler: Could not create run queue\n");
+		}
 	}
 }
 
@@ -41,8 +45,18 @@ scheduler_bootstrap(void)
 int
 scheduler_preallocate(int nthreads)
 {
+	int i, result;
+
 	assert(curspl>0);
-	return q_preallocate(runqueue, nthreads);
+
+	/* Any level may end up holding every thread */
+	for (i=0; i<NPRI; i++) {
+		result = q_preallocate(runqueues[i], nthreads);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
 }
 
 /*
@@ -54,10 +68,15 @@ scheduler_preallocate(int nthreads)
 void
 scheduler_killall(void)
 {
+	int i;
+
 	assert(curspl>0);
-	while (!q_empty(runqueue)) {
-		struct thread *t = q_remhead(runqueue);
-		kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+	for (i=0; i<NPRI; i++) {
+		while (!q_empty(runqueues[i])) {
+			struct thread *t = q_remhead(runqueues[i]);
+			t->t_runpri = -1;
+			kprintf("scheduler: Dropping thread %s.\n", t->t_name);
+		}
 	}
 }
 
@@ -71,11 +90,15 @@ scheduler_killall(void)
 void
 scheduler_shutdown(void)
 {
+	int i;
+
 	scheduler_killall();
 
 	assert(curspl>0);
-	q_destroy(runqueue);
-	runqueue = NULL;
+	for (i=0; i<NPRI; i++) {
+		q_destroy(runqueues[i]);
+		runqueues[i] = NULL;
+	}
 }
 
 /*
@@ -87,10 +110,21 @@ scheduler_shutdown(void)
 struct thread *
 scheduler(void)
 {
+	struct thread *t;
+	int i;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
 	
-	while (q_empty(runqueue)) {
+	for (;;) {
+		for (i=PRI_MAX; i>=PRI_MIN; i--) {
+			if (!q_empty(runqueues[i])) {
+				break;
+			}
+		}
+		if (i >= PRI_MIN) {
+			break;
+		}
 		cpu_idle();
 	}
 
@@ -101,20 +135,71 @@ scheduler(void)
 	// 
 	//print_run_queue();
 	
-	return q_remhead(runqueue);
+	t = q_remhead(runqueues[i]);
+	t->t_runpri = -1;
+	return t;
 }
 
 /* 
  * Make a thread runnable.
- * With the base scheduler, just add it to the end of the run queue.
+ * Add it to the end of the run queue for its current priority.
  */
 int
 make_runnable(struct thread *t)
 {
+	int result;
+
 	// meant to be called with interrupts off
 	assert(curspl>0);
+	assert(t->t_pri >= PRI_MIN && t->t_pri <= PRI_MAX);
+
+	result = q_addtail(runqueues[t->t_pri], t);
+	if (result == 0) {
+		t->t_runpri = t->t_pri;
+	}
+	return result;
+}
+
+/*
+ * Change a thread's effective priority. If it's sitting in a run
+ * queue, pull it out and put it at the tail of the new level. The
+ * queue has no remove-from-middle, so rotate the old level once,
+ * dropping T on the way. This only happens when priority inheritance
+ * boosts or restores a preempted thread, so the cost is fine.
+ */
+void
+scheduler_reprioritize(struct thread *t, int pri)
+{
+	struct queue *q;
+	struct thread *x;
+	int n, result;
+
+	assert(curspl>0);
+	assert(pri >= PRI_MIN && pri <= PRI_MAX);
+
+	if (t->t_pri == pri) {
+		return;
+	}
+	t->t_pri = pri;
 
-	return q_addtail(runqueue, t);
+	if (t->t_runpri < 0) {
+		/* Running or asleep; it'll be queued at PRI next time */
+		return;
+	}
+
+	q = runqueues[t->t_runpri];
+	n = (q_getend(q) - q_getstart(q) + q_getsize(q)) % q_getsize(q);
+	while (n-- > 0) {
+		x = q_remhead(q);
+		if (x != t) {
+			result = q_addtail(q, x);
+			assert(result==0);
+		}
+	}
+
+	/* Because we preallocate during thread_fork, this can't fail */
+	result = make_runnable(t);
+	assert(result==0);
 }
 
 /*
@@ -126,14 +211,19 @@ print_run_queue(void)
 	/* Turn interrupts off so the whole list prints atomically. */
 	int spl = splhigh();
 
-	int i,k=0;
-	i = q_getstart(runqueue);
-	
-	while (i!=q_getend(runqueue)) {
-		struct thread *t = q_getguy(runqueue, i);
-		kprintf("  %2d: %s %p\n", k, t->t_name, t->t_sleepaddr);
-		i=(i+1)%q_getsize(runqueue);
-		k++;
+	int i,k=0,p;
+
+	for (p=PRI_MAX; p>=PRI_MIN; p--) {
+		struct queue *q = runqueues[p];
+
+		i = q_getstart(q);
+		while (i!=q_getend(q)) {
+			struct thread *t = q_getguy(q, i);
+			kprintf("  %2d: [%d] %s %p\n", k, p, t->t_name,
+				t->t_sleepaddr);
+			i=(i+1)%q_getsize(q);
+			k++;
+		}
 	}
 	
 	splx(spl);
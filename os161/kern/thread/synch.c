@@ -8,6 +8,7 @@
 #include <synch.h>
 #include <thread.h>
 #include <curthread.h>
+#include <scheduler.h>
 #include <machine/spl.h>
 
 ////////////////////////////////////////////////////////////
@@ -114,8 +115,10 @@ lock_create(const char *name)
 		return NULL;
 	}
 	
-	lock->threadHolder = curthread;
+	lock->threadHolder = NULL;
 	lock->isHeld = 0;                     
+	threadlist_init(&lock->waiters);
+	lock->l_heldnext = NULL;
 
 	return lock;
 }
@@ -128,27 +131,118 @@ lock_destroy(struct lock *lock)
 	assert(lock->isHeld == 0);    //check if the lock is held
 
 	spl = splhigh();	         
-	assert(thread_hassleepers(lock)==0);  //make sure no threads are sleeping on specified address
-	splx(spl);                //set priority level to high
+	assert(threadlist_isempty(&lock->waiters));  //make sure no threads are waiting for it
+	splx(spl);
 
 	kfree(lock->name);
-	kfree(lock->threadHolder);
 	kfree(lock);
 }
 
+/*
+ * Bookkeeping for the list of locks each thread holds, which is what
+ * its inherited priority is computed from.
+ */
+static
+void
+lock_addheld(struct lock *lock, struct thread *t)
+{
+	lock->l_heldnext = t->t_heldlocks;
+	t->t_heldlocks = lock;
+}
+
+static
+void
+lock_removeheld(struct lock *lock, struct thread *t)
+{
+	struct lock **lp;
+
+	for (lp = &t->t_heldlocks; *lp != NULL; lp = &(*lp)->l_heldnext) {
+		if (*lp == lock) {
+			*lp = lock->l_heldnext;
+			lock->l_heldnext = NULL;
+			return;
+		}
+	}
+	panic("lock_removeheld: %s not held by %s\n", lock->name, t->t_name);
+}
+
+void
+lock_propagate_priority(struct thread *t)
+{
+	struct lock *l;
+	struct thread *w;
+	int pri;
+
+	assert(curspl>0);
+
+	while (t != NULL) {
+		pri = t->t_basepri;
+		for (l = t->t_heldlocks; l != NULL; l = l->l_heldnext) {
+			for (w = l->waiters.tl_head; w != NULL; w = w->t_waitnext) {
+				if (w->t_pri > pri) {
+					pri = w->t_pri;
+				}
+			}
+		}
+		if (pri == t->t_pri) {
+			/* Nothing changes further down the chain either */
+			return;
+		}
+		scheduler_reprioritize(t, pri);
+
+		l = t->t_blockedon;
+		t = (l != NULL) ? (struct thread *)l->threadHolder : NULL;
+	}
+}
+
+/*
+ * Lend our priority to the holder of LOCK, and to the holder of
+ * whatever lock that thread is waiting for, and so on. Only ever
+ * raises priorities, so it can stop at the first thread that is
+ * already high enough.
+ */
+static
+void
+lock_boost(struct lock *lock)
+{
+	struct thread *t = (struct thread *)lock->threadHolder;
+	int pri = curthread->t_pri;
+
+	while (t != NULL && t->t_pri < pri) {
+		scheduler_reprioritize(t, pri);
+		lock = t->t_blockedon;
+		t = (lock != NULL) ? (struct thread *)lock->threadHolder : NULL;
+	}
+}
+
 void
 lock_acquire(struct lock *lock)
 {
 	int spl;
 	assert(lock != NULL);        
+	assert(in_interrupt==0);
 	spl = splhigh();
 
-	while(lock->isHeld == 1){
-		thread_sleep(lock);          // only one thread can hold the lock at the same time     
+	/* Would deadlock against ourselves */
+	assert(!lock_do_i_hold(lock));
+
+	if (lock->isHeld) {
+		/*
+		 * Queue up behind the other waiters. lock_release
+		 * makes us the holder before waking us, so there is
+		 * nothing to re-check when we get back.
+		 */
+		curthread->t_blockedon = lock;
+		lock_boost(lock);
+		thread_sleep_on(&lock->waiters);
+		assert(lock->isHeld && lock->threadHolder == curthread);
+		assert(curthread->t_blockedon == NULL);
+	}
+	else {
+		lock->threadHolder = curthread;
+		lock->isHeld= 1;
+		lock_addheld(lock, curthread);
 	}
-
-	lock->threadHolder = curthread;
-	lock->isHeld= 1;
 
 	splx(spl);
 }
@@ -157,13 +251,29 @@ void
 lock_release(struct lock *lock)
 {
 	int spl;
+	struct thread *next;
 	assert(lock != NULL);
 	spl = splhigh();
 
 	if(lock_do_i_hold(lock)){          //release lock only if it is held by a thread
-		lock->threadHolder = NULL;        
-		lock->isHeld = 0;
-		thread_wakeup(lock);
+		lock_removeheld(lock, curthread);
+
+		/* Hand the lock straight to the best waiter, if any */
+		next = thread_wakebest(&lock->waiters);
+		if (next != NULL) {
+			lock->threadHolder = next;
+			next->t_blockedon = NULL;
+			lock_addheld(lock, next);
+			/* It now inherits from the waiters it left behind */
+			lock_propagate_priority(next);
+		}
+		else {
+			lock->threadHolder = NULL;        
+			lock->isHeld = 0;
+		}
+
+		/* Give back whatever we borrowed through this lock */
+		lock_propagate_priority(curthread);
 	}
 
 	splx(spl);
@@ -204,7 +314,7 @@ cv_create(const char *name)
 		return NULL;
 	}
 	
-	cv->lock_hold = lock_create(name);
+	threadlist_init(&cv->waiters);
 	return cv;
 }
 
@@ -215,11 +325,10 @@ cv_destroy(struct cv *cv)
 	assert(cv != NULL);
 
 	spl = splhigh();
-	assert(thread_hassleepers(cv)==0);
+	assert(threadlist_isempty(&cv->waiters));
 	splx(spl);
 	
 	kfree(cv->name);
-	kfree(cv->lock_hold);
 	kfree(cv);
 }
 
@@ -230,13 +339,15 @@ cv_wait(struct cv *cv, struct lock *lock)
 	int spl;
 	assert(lock != NULL);  
 	assert(cv != NULL); 
+	assert(lock_do_i_hold(lock));
 
+	/*
+	 * Releasing the lock and going to sleep happen with interrupts
+	 * off, so a signal can't slip in between and get lost.
+	 */
 	spl = splhigh();
- 	lock_acquire(cv->lock_hold);
 	lock_release(lock);
-	lock_release(cv->lock_hold);
-
-	thread_sleep(cv);
+	thread_sleep_on(&cv->waiters);
 
 	lock_acquire(lock);
 	splx(spl);
@@ -251,8 +362,7 @@ cv_signal(struct cv *cv, struct lock *lock)
 	assert(cv != NULL); 
 	spl = splhigh();
 	
-	
-	thread_wakeup_1(cv);
+	thread_wakeone(&cv->waiters);
 	
 	splx(spl);
 }
@@ -265,6 +375,152 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	assert(cv != NULL); 
 	spl = splhigh();
  
-	thread_wakeup(cv);
+	thread_wakeall(&cv->waiters);
 	splx(spl);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(struct rwlock));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->name = kstrdup(name);
+	if (rw->name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readers = 0;
+	rw->rw_writer = NULL;
+	threadlist_init(&rw->rw_readwait);
+	threadlist_init(&rw->rw_writewait);
+
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+
+	spl = splhigh();
+	assert(rw->rw_readers == 0);
+	assert(rw->rw_writer == NULL);
+	assert(threadlist_isempty(&rw->rw_readwait));
+	assert(threadlist_isempty(&rw->rw_writewait));
+	splx(spl);
+
+	kfree(rw->name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+	spl = splhigh();
+
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer != NULL || !threadlist_isempty(&rw->rw_writewait)) {
+		/*
+		 * Wait behind the writer(s). Whoever wakes us has
+		 * already counted us in rw_readers.
+		 */
+		thread_sleep_on(&rw->rw_readwait);
+		assert(rw->rw_writer == NULL && rw->rw_readers > 0);
+	}
+	else {
+		rw->rw_readers++;
+	}
+
+	splx(spl);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	spl = splhigh();
+
+	assert(rw->rw_readers > 0);
+	rw->rw_readers--;
+
+	/* Last reader out lets the first waiting writer in */
+	if (rw->rw_readers == 0) {
+		rw->rw_writer = thread_wakeone(&rw->rw_writewait);
+	}
+
+	splx(spl);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	assert(in_interrupt==0);
+	spl = splhigh();
+
+	assert(rw->rw_writer != curthread);
+
+	if (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		thread_sleep_on(&rw->rw_writewait);
+		assert(rw->rw_writer == curthread && rw->rw_readers == 0);
+	}
+	else {
+		rw->rw_writer = curthread;
+	}
+
+	splx(spl);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	int spl;
+
+	assert(rw != NULL);
+	spl = splhigh();
+
+	assert(rwlock_do_i_hold_write(rw));
+
+	/*
+	 * Readers that queued up while we held the lock go first, all
+	 * together; otherwise the next writer.
+	 */
+	rw->rw_writer = NULL;
+	if (!threadlist_isempty(&rw->rw_readwait)) {
+		rw->rw_readers = rw->rw_readwait.tl_count;
+		thread_wakeall(&rw->rw_readwait);
+	}
+	else {
+		rw->rw_writer = thread_wakeone(&rw->rw_writewait);
+	}
+
+	splx(spl);
+}
+
+int
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	assert(rw != NULL);
+	return rw->rw_writer == curthread;
+}
@@ -12,6 +12,9 @@
 #include <scheduler.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <file.h>
+#include <queue.h>
+#include <kern/unistd.h>
 #include "opt-synchprobs.h"
 
 /* States a thread can be in. */
@@ -19,6 +22,7 @@ typedef enum {
 	S_RUN,
 	S_READY,
 	S_SLEEP,
+	S_WAIT,		/* asleep on a threadlist; already queued there */
 	S_ZOMB,
 } threadstate_t;
 
@@ -35,6 +39,43 @@ static struct array *zombies;
 static int numthreads;
 
 
+/*
+ * Free PIDs, oldest-freed first. Handing PIDs out in FIFO order makes
+ * allocation O(1) and keeps a PID that was just reaped from being
+ * reused right away (the queue acts as a rotating next-PID hint).
+ */
+static struct queue *freepids;
+
+/* Number of live (not yet reaped) processes, and the cap on it. */
+static int numprocs;
+static int proclimit = PROC_LIMIT;
+
+/*
+ * Unlink a process from its parent's child list.
+ */
+static
+void
+proc_unlink_child(procContBlock *pcb)
+{
+	assert(curspl>0);
+
+	if (pcb->parentID == NO_PARENT || listProcesses[pcb->parentID] == NULL) {
+		return;
+	}
+
+	if (pcb->prevSibling != NO_PID) {
+		listProcesses[pcb->prevSibling]->nextSibling = pcb->nextSibling;
+	}
+	else {
+		listProcesses[pcb->parentID]->firstChild = pcb->nextSibling;
+	}
+	if (pcb->nextSibling != NO_PID) {
+		listProcesses[pcb->nextSibling]->prevSibling = pcb->prevSibling;
+	}
+	pcb->nextSibling = NO_PID;
+	pcb->prevSibling = NO_PID;
+}
+
 void processRemove(u_int32_t pID)
 {
 	int spl = splhigh();
@@ -45,9 +86,15 @@ void processRemove(u_int32_t pID)
 	}
 	else
 	{
+		assert(threadlist_isempty(&listProcesses[pID]->exitWaiters));
+		proc_unlink_child(listProcesses[pID]);
 		listProcesses[pID]->processThread = NULL;
 		kfree(listProcesses[pID]);
 		listProcesses[pID] = NULL;
+
+		/* Space was preallocated in thread_bootstrap; can't fail */
+		numprocs--;
+		q_addtail(freepids, (void *)pID);
 		splx(spl);
 		return;
 	}
@@ -55,15 +102,139 @@ void processRemove(u_int32_t pID)
 
 int assign_pID(unsigned int * pID){
 	assert(curspl > 0);
-	int j;
 
-	for (j = 1; j < MAX_PID; j++) {
-		if (listProcesses[j] == NULL){ 
-			*pID = j;
-			return 0;
+	if (numprocs >= proclimit || q_empty(freepids)) {
+		return EAGAIN;
+	}
+	*pID = (unsigned int)q_remhead(freepids);
+	assert(*pID >= MIN_PID && *pID < MAX_PID);
+	assert(listProcesses[*pID] == NULL);
+	numprocs++;
+	return 0;
+}
+
+/*
+ * Set up the process control block for a new process PID whose parent
+ * is PARENTID, and link it onto the parent's child list.
+ */
+static
+int
+proc_create(u_int32_t pID, int parentID, struct thread *t)
+{
+	procContBlock *pcb;
+
+	assert(curspl>0);
+
+	pcb = kmalloc(sizeof(procContBlock));
+	if (pcb == NULL) {
+		return ENOMEM;
+	}
+	pcb->exited = 0;
+	pcb->exitCode = 0;
+	pcb->processThread = t;
+	pcb->parentID = parentID;
+	pcb->waited = 0;
+	pcb->firstChild = NO_PID;
+	pcb->prevSibling = NO_PID;
+	pcb->nextSibling = NO_PID;
+	threadlist_init(&pcb->exitWaiters);
+
+	if (parentID != NO_PARENT) {
+		procContBlock *parent = listProcesses[parentID];
+		assert(parent != NULL);
+		pcb->nextSibling = parent->firstChild;
+		if (parent->firstChild != NO_PID) {
+			listProcesses[parent->firstChild]->prevSibling = pID;
 		}
-	} 
-	return EAGAIN;
+		parent->firstChild = pID;
+	}
+
+	listProcesses[pID] = pcb;
+	return 0;
+}
+
+/*
+ * Called when process PID exits. Children that have already exited
+ * can never be waited for now, so reap them; the rest lose their
+ * parent and will be reaped when they exit. Only the children of PID
+ * are visited.
+ */
+void
+proc_orphan_children(u_int32_t pID)
+{
+	int child, next;
+	int spl = splhigh();
+
+	child = listProcesses[pID]->firstChild;
+	while (child != NO_PID) {
+		procContBlock *cpcb = listProcesses[child];
+		next = cpcb->nextSibling;
+
+		if (cpcb->exited) {
+			processRemove(child);
+		}
+		else {
+			cpcb->parentID = NO_PARENT;
+			cpcb->prevSibling = NO_PID;
+			cpcb->nextSibling = NO_PID;
+		}
+		child = next;
+	}
+	listProcesses[pID]->firstChild = NO_PID;
+
+	splx(spl);
+}
+
+/*
+ * Change the cap on the number of live processes. Processes already
+ * running are not affected if the new limit is lower.
+ */
+int
+proc_setlimit(int limit)
+{
+	if (limit < 1 || limit >= MAX_PID) {
+		return EINVAL;
+	}
+	proclimit = limit;
+	return 0;
+}
+
+/*
+ * Wait for child process PID of the current process to exit, and hand
+ * back its pcb. With WNOHANG in OPTIONS, hand back the pcb right away
+ * even if the child is still running (check ->exited). The caller
+ * reaps the child with processRemove once it has used the exit code.
+ *
+ * The wait sleeps on the child's own completion object, so only
+ * this child's exit wakes us. Interrupts must be off.
+ */
+int
+proc_wait(int pID, int options, procContBlock **ret)
+{
+	procContBlock *pcb;
+
+	assert(curspl>0);
+
+	if (options & ~WNOHANG) {
+		return EINVAL;
+	}
+	if (pID < MIN_PID || pID >= MAX_PID || pID == (int)curthread->pID) {
+		return EINVAL;
+	}
+
+	pcb = listProcesses[pID];
+	if (pcb == NULL || pcb->parentID != (int)curthread->pID) {
+		return EINVAL;
+	}
+
+	if (!(options & WNOHANG)) {
+		while (!pcb->exited) {
+			thread_sleep_on(&pcb->exitWaiters);
+		}
+	}
+
+	*ret = pcb;
+	return 0;
 }
 
 
@@ -90,12 +261,18 @@ thread_create(const char *name)
 		return NULL;
 	}
 	thread->t_sleepaddr = NULL;
+	thread->t_waitnext = NULL;
 	thread->t_stack = NULL;
+	thread->t_basepri = PRI_DEFAULT;
+	thread->t_pri = PRI_DEFAULT;
+	thread->t_runpri = -1;
+	thread->t_blockedon = NULL;
+	thread->t_heldlocks = NULL;
 	thread->t_vmspace = NULL;
 	thread->t_cwd = NULL;
+	thread->t_filetable = NULL;
 	thread->pID = 0;
-	thread->wait = sem_create("wait",0);
-	
+
 	return thread;
 }
 
@@ -118,6 +295,7 @@ thread_destroy(struct thread *thread) //doesn't delete the pcb of this thread !
 	// These things are cleaned up in thread_exit.
 	assert(thread->t_vmspace==NULL);
 	assert(thread->t_cwd==NULL);
+	assert(thread->t_filetable==NULL);
 	
 	if (thread->t_stack) {
 		kfree(thread->t_stack);
@@ -222,6 +400,20 @@ thread_bootstrap(void)
 		listProcesses[i] = NULL;
 	}
 
+	/*
+	 * Every PID but the boot thread's goes on the free list. Size
+	 * the queue for all of them so processRemove never has to grow it.
+	 */
+	freepids = q_create(MAX_PID);
+	if (freepids == NULL) {
+		panic("Cannot create free PID queue\n");
+	}
+	for (i = MIN_PID + 1; i < MAX_PID; i++) {
+		if (q_addtail(freepids, (void *)i)) {
+			panic("Cannot fill free PID queue\n");
+		}
+	}
+
 	/*
 	 * Create the thread structure for the first thread
 	 * (the one that's already running)
@@ -242,16 +434,11 @@ thread_bootstrap(void)
 	/* Set curthread */
 	curthread = me;
 
-	listProcesses[1] = kmalloc(sizeof(procContBlock));
-	if(listProcesses[1] == NULL){
+	if (proc_create(MIN_PID, NO_PARENT, curthread)) {
 		panic("listProcesses[1] can not be allocated.");
 	}
-	listProcesses[1] -> exited = 0;
-	listProcesses[1] -> exitCode = 0;
-	listProcesses[1] -> processThread = curthread;
-	listProcesses[1] -> parentID = -1;
-	listProcesses[1] -> waited = 0;
-	curthread->pID = 1;
+	numprocs = 1;
+	curthread->pID = MIN_PID;
 
 	numthreads = 1;
 
@@ -310,12 +497,31 @@ thread_fork(const char *name,
 	newguy->t_stack[2] = 0xda;
 	newguy->t_stack[3] = 0x33;
 
+	/* Inherit our base priority (not anything we've borrowed) */
+	newguy->t_basepri = curthread->t_basepri;
+	newguy->t_pri = curthread->t_basepri;
+
 	/* Inherit the current directory */
 	if (curthread->t_cwd != NULL) {
 		VOP_INCREF(curthread->t_cwd);
 		newguy->t_cwd = curthread->t_cwd;
 	}
 
+	/* Inherit open files; the child shares our open file objects */
+	if (curthread->t_filetable != NULL) {
+		result = filetable_copy(curthread->t_filetable,
+					&newguy->t_filetable);
+		if (result) {
+			if (newguy->t_cwd != NULL) {
+				VOP_DECREF(newguy->t_cwd);
+			}
+			kfree(newguy->t_stack);
+			kfree(newguy->t_name);
+			kfree(newguy);
+			return result;
+		}
+	}
+
 	/* Set up the pcb (this arranges for func to be called) */
 	md_initpcb(&newguy->t_pcb, newguy->t_stack, data1, data2, func);
 
@@ -323,16 +529,20 @@ thread_fork(const char *name,
 	s = splhigh();
 
 	result = assign_pID(&(newguy->pID));
-////////////////////////////////////////////////////////////////////////////////
-	listProcesses[newguy->pID] = kmalloc(sizeof(procContBlock));
-	if(listProcesses[newguy->pID] == NULL){
-		panic("listProcesses allocateing failed");
+	if (result) {
+		goto fail;
+	}
+	/* Nobody can wait for a thread whose creator didn't keep it */
+	result = proc_create(newguy->pID,
+			     ret != NULL ? (int)curthread->pID : NO_PARENT,
+			     newguy);
+	if (result) {
+		/* give the PID back; there is no pcb to unlink yet */
+		numprocs--;
+		q_addtail(freepids, (void *)newguy->pID);
+		newguy->pID = 0;
+		goto fail;
 	}
-	listProcesses[newguy->pID] -> exited = 0;
-	listProcesses[newguy->pID] -> exitCode = 0;
-	listProcesses[newguy->pID] -> processThread = curthread;
-	listProcesses[newguy->pID] -> parentID = curthread-> pID;
-////////////////////////////////////////////////////////////////////////////////	
 
 	/*
 	 * Make sure our data structures have enough space, so we won't
@@ -385,10 +595,17 @@ thread_fork(const char *name,
 	return 0;
 
  fail:
+	if (newguy->pID != 0) {
+		processRemove(newguy->pID);
+	}
 	splx(s);
 	if (newguy->t_cwd != NULL) {
 		VOP_DECREF(newguy->t_cwd);
 	}
+	if (newguy->t_filetable != NULL) {
+		filetable_destroy(newguy->t_filetable);
+		newguy->t_filetable = NULL;
+	}
 	kfree(newguy->t_stack);
 	kfree(newguy->t_name);
 	kfree(newguy);
@@ -449,6 +666,10 @@ mi_switch(threadstate_t nextstate)
 		 */
 		result = array_add(sleepers, cur);
 	}
+	else if (nextstate==S_WAIT) {
+		/* thread_sleep_on already linked us onto the threadlist */
+		result = 0;
+	}
 	else {
 		assert(nextstate==S_ZOMB);
 		result = array_add(zombies, cur);
@@ -511,6 +732,16 @@ thread_exit(void)
 		assert(curthread->t_stack[3] == (char)0x33);
 	}
 
+	/*
+	 * Close our files while interrupts are still on; the last
+	 * close of a file may have to go to disk.
+	 */
+	if (curthread->t_filetable) {
+		struct filetable *ft = curthread->t_filetable;
+		curthread->t_filetable = NULL;
+		filetable_destroy(ft);
+	}
+
 	splhigh();
 
 	if (curthread->t_vmspace) {
@@ -531,11 +762,24 @@ thread_exit(void)
 	procContBlock* this_pcb = listProcesses[curthread->pID];
 	this_pcb -> exited = 1;
 
+	/* Nobody can wait for our children any more */
+	proc_orphan_children(curthread->pID);
+
+	/*
+	 * If nobody can wait for us either, give up our PID now.
+	 * Otherwise signal our completion object; the only thread
+	 * that can be on it is our parent, in waitpid.
+	 */
+	if (this_pcb->parentID == NO_PARENT) {
+		processRemove(curthread->pID);
+	}
+	else {
+		thread_wakeall(&this_pcb->exitWaiters);
+	}
+
 	assert(numthreads>0);
 	numthreads--;
 
-	//before the thread really exits, wake up the sleeping thread.
-	thread_wakeup_1(curthread->pID);
 	mi_switch(S_ZOMB);
 	panic("Thread came back from the dead!\n");
 }
@@ -647,6 +891,140 @@ thread_hassleepers(const void *addr)
 	return 0;
 }
 
+/*
+ * Threadlists: per-object queues of sleeping threads. See threadlist.h.
+ */
+void
+threadlist_init(struct threadlist *tl)
+{
+	tl->tl_head = NULL;
+	tl->tl_tail = NULL;
+	tl->tl_count = 0;
+}
+
+int
+threadlist_isempty(struct threadlist *tl)
+{
+	return tl->tl_count == 0;
+}
+
+/*
+ * Go to sleep at the tail of threadlist TL until thread_wakeone or
+ * thread_wakeall picks us. Same rules as thread_sleep: interrupts must
+ * be off and we must not be in an interrupt handler.
+ */
+void
+thread_sleep_on(struct threadlist *tl)
+{
+	assert(in_interrupt==0);
+	assert(curspl>0);
+
+	curthread->t_sleepaddr = tl;
+	curthread->t_waitnext = NULL;
+	if (tl->tl_tail == NULL) {
+		tl->tl_head = curthread;
+	}
+	else {
+		tl->tl_tail->t_waitnext = curthread;
+	}
+	tl->tl_tail = curthread;
+	tl->tl_count++;
+
+	mi_switch(S_WAIT);
+
+	curthread->t_sleepaddr = NULL;
+}
+
+struct thread *
+thread_wakeone(struct threadlist *tl)
+{
+	struct thread *t;
+	int result;
+
+	assert(curspl>0);
+
+	t = tl->tl_head;
+	if (t == NULL) {
+		return NULL;
+	}
+	tl->tl_head = t->t_waitnext;
+	if (tl->tl_head == NULL) {
+		tl->tl_tail = NULL;
+	}
+	tl->tl_count--;
+	t->t_waitnext = NULL;
+
+	/*
+	 * Because we preallocate during thread_fork,
+	 * this should never fail.
+	 */
+	result = make_runnable(t);
+	assert(result==0);
+	return t;
+}
+
+void
+thread_wakeall(struct threadlist *tl)
+{
+	while (thread_wakeone(tl) != NULL) {
+		/* nothing */
+	}
+}
+
+struct thread *
+thread_wakebest(struct threadlist *tl)
+{
+	struct thread *t, *prev, *best, *bestprev;
+	int result;
+
+	assert(curspl>0);
+
+	best = bestprev = NULL;
+	for (prev = NULL, t = tl->tl_head; t != NULL; prev = t, t = t->t_waitnext) {
+		if (best == NULL || t->t_pri > best->t_pri) {
+			best = t;
+			bestprev = prev;
+		}
+	}
+	if (best == NULL) {
+		return NULL;
+	}
+
+	if (bestprev == NULL) {
+		tl->tl_head = best->t_waitnext;
+	}
+	else {
+		bestprev->t_waitnext = best->t_waitnext;
+	}
+	if (tl->tl_tail == best) {
+		tl->tl_tail = bestprev;
+	}
+	tl->tl_count--;
+	best->t_waitnext = NULL;
+
+	result = make_runnable(best);
+	assert(result==0);
+	return best;
+}
+
+int
+thread_setpriority(struct thread *t, int pri)
+{
+	int spl;
+
+	if (pri < PRI_MIN || pri > PRI_MAX) {
+		return EINVAL;
+	}
+
+	spl = splhigh();
+	t->t_basepri = pri;
+	/* Recompute what T inherits and push the change down its lock chain */
+	lock_propagate_priority(t);
+	splx(spl);
+
+	return 0;
+}
+
 /*
  * New threads actually come through here on the way to the function
  * they're supposed to start in. This is so when that function exits,
@@ -681,32 +1059,3 @@ mi_threadstart(void *data1, unsigned long data2,
 	/* Done. */
 	thread_exit();
 }
-void thread_wakeup_1(const void *addr)
-{
-	int i, result;
-	
-	// meant to be called with interrupts off
-	assert(curspl>0);
-	
-	// This is inefficient. Feel free to improve it.
-	
-	for (i=0; i<array_getnum(sleepers); i++) {
-		struct thread *t = array_getguy(sleepers, i);
-		if (t->t_sleepaddr == addr) {
-			
-			// Remove from list
-			array_remove(sleepers, i);
-			
-			// must look at the same sleepers[i] again
-			i--;
-
-			/*
-			 * Because we preallocate during thread_fork,
-			 * this should never fail.
-			 */
-			result = make_runnable(t);
-			assert(result==0);
-			return;
-		}
-	}
-}
\ No newline at end of file
@@ -0,0 +1,322 @@
+/*
+ * Open file objects and per-process file descriptor tables.
+ * See file.h for the interface.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/unistd.h>
+#include <lib.h>
+#include <synch.h>
+#include <thread.h>
+#include <curthread.h>
+#include <machine/spl.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <file.h>
+#include <pipe.h>
+
+/*
+ * Wrap the open vnode VN in a fresh openfile with one reference. The
+ * openfile takes over the caller's open reference to VN.
+ */
+static
+int
+openfile_create(struct vnode *vn, int flags, struct openfile **ret)
+{
+	struct openfile *of;
+
+	of = kmalloc(sizeof(struct openfile));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+
+	of->of_vnode = vn;
+	of->of_flags = flags;
+	of->of_offset = 0;
+	of->of_refcount = 1;
+	of->of_seekable = (VOP_TRYSEEK(vn, 0) == 0);
+
+	*ret = of;
+	return 0;
+}
+
+/*
+ * Open PATH and wrap it in an openfile.
+ */
+static
+int
+openfile_open(char *path, int flags, struct openfile **ret)
+{
+	struct vnode *vn;
+	int result;
+
+	result = vfs_open(path, flags, &vn);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_create(vn, flags, ret);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	return 0;
+}
+
+static
+void
+openfile_incref(struct openfile *of)
+{
+	int spl;
+
+	spl = splhigh();
+	of->of_refcount++;
+	splx(spl);
+}
+
+/*
+ * Drop a reference; close the vnode when the last one goes.
+ */
+static
+void
+openfile_decref(struct openfile *of)
+{
+	int last, spl;
+
+	spl = splhigh();
+	assert(of->of_refcount > 0);
+	of->of_refcount--;
+	last = (of->of_refcount == 0);
+	splx(spl);
+
+	if (last) {
+		vfs_close(of->of_vnode);
+		lock_destroy(of->of_lock);
+		kfree(of);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	int i;
+
+	ft = kmalloc(sizeof(struct filetable));
+	if (ft == NULL) {
+		return NULL;
+	}
+	for (i=0; i<OPEN_MAX; i++) {
+		ft->ft_files[i] = NULL;
+	}
+	return ft;
+}
+
+int
+filetable_copy(struct filetable *src, struct filetable **ret)
+{
+	struct filetable *ft;
+	int i;
+
+	ft = filetable_create();
+	if (ft == NULL) {
+		return ENOMEM;
+	}
+
+	for (i=0; i<OPEN_MAX; i++) {
+		if (src->ft_files[i] != NULL) {
+			openfile_incref(src->ft_files[i]);
+			ft->ft_files[i] = src->ft_files[i];
+		}
+	}
+
+	*ret = ft;
+	return 0;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	int i;
+
+	for (i=0; i<OPEN_MAX; i++) {
+		if (ft->ft_files[i] != NULL) {
+			openfile_decref(ft->ft_files[i]);
+			ft->ft_files[i] = NULL;
+		}
+	}
+	kfree(ft);
+}
+
+int
+filetable_stdio(struct filetable *ft)
+{
+	static const int modes[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+	char path[5];
+	int fd, result;
+
+	for (fd=STDIN_FILENO; fd<=STDERR_FILENO; fd++) {
+		assert(ft->ft_files[fd] == NULL);
+
+		/* vfs_open may destroy the path, so use a fresh copy */
+		strcpy(path, "con:");
+		result = openfile_open(path, modes[fd], &ft->ft_files[fd]);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Find the lowest free descriptor at or above START.
+ */
+static
+int
+filetable_findfree(struct filetable *ft, int start, int *retfd)
+{
+	int fd;
+
+	for (fd=start; fd<OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] == NULL) {
+			*retfd = fd;
+			return 0;
+		}
+	}
+	return EMFILE;
+}
+
+int
+file_open(char *path, int flags, int *retfd)
+{
+	struct filetable *ft = curthread->t_filetable;
+	struct openfile *of;
+	int fd, result;
+
+	assert(ft != NULL);
+
+	/* Find a slot first, so we don't open anything we can't keep */
+	result = filetable_findfree(ft, 0, &fd);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_open(path, flags, &of);
+	if (result) {
+		return result;
+	}
+
+	ft->ft_files[fd] = of;
+	*retfd = fd;
+	return 0;
+}
+
+int
+file_pipe(int *retfds)
+{
+	struct filetable *ft = curthread->t_filetable;
+	struct vnode *rvn, *wvn;
+	struct openfile *rof, *wof;
+	int rfd, wfd, result;
+
+	assert(ft != NULL);
+
+	result = filetable_findfree(ft, 0, &rfd);
+	if (result) {
+		return result;
+	}
+	result = filetable_findfree(ft, rfd+1, &wfd);
+	if (result) {
+		return result;
+	}
+
+	result = pipe_create(PIPE_SIZE, &rvn, &wvn);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_create(rvn, O_RDONLY, &rof);
+	if (result) {
+		vfs_close(rvn);
+		vfs_close(wvn);
+		return result;
+	}
+	result = openfile_create(wvn, O_WRONLY, &wof);
+	if (result) {
+		openfile_decref(rof);
+		vfs_close(wvn);
+		return result;
+	}
+
+	ft->ft_files[rfd] = rof;
+	ft->ft_files[wfd] = wof;
+	retfds[0] = rfd;
+	retfds[1] = wfd;
+	return 0;
+}
+
+int
+file_close(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	result = file_get(fd, &of);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_filetable->ft_files[fd] = NULL;
+	openfile_decref(of);
+	return 0;
+}
+
+int
+file_dup2(int oldfd, int newfd)
+{
+	struct filetable *ft = curthread->t_filetable;
+	struct openfile *of, *prev;
+	int result;
+
+	result = file_get(oldfd, &of);
+	if (result) {
+		return result;
+	}
+	if (newfd < 0 || newfd >= OPEN_MAX) {
+		return EBADF;
+	}
+	if (newfd == oldfd) {
+		return 0;
+	}
+
+	prev = ft->ft_files[newfd];
+	openfile_incref(of);
+	ft->ft_files[newfd] = of;
+	if (prev != NULL) {
+		openfile_decref(prev);
+	}
+	return 0;
+}
+
+int
+file_get(int fd, struct openfile **ret)
+{
+	struct filetable *ft = curthread->t_filetable;
+
+	if (ft == NULL || fd < 0 || fd >= OPEN_MAX || ft->ft_files[fd] == NULL) {
+		return EBADF;
+	}
+	*ret = ft->ft_files[fd];
+	return 0;
+}
@@ -0,0 +1,610 @@
+/*
+ * Anonymous pipes. See pipe.h for the interface.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <synch.h>
+#include <curthread.h>
+#include <thread.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pipe.h>
+
+/* Most pages a writer lends out at once */
+#define PIPE_LOANPAGES  16
+
+/*
+ * The buffer holds p_count bytes starting at p_head, wrapping at
+ * p_size. Everything is protected by p_lock. Readers wait on p_readcv
+ * for data or for the writer to go away; writers wait on p_writecv for
+ * space or for the reader to go away.
+ *
+ * Large page-aligned writes that don't fit in the free space skip the
+ * buffer: the writer, which would have to wait for the reader anyway,
+ * pins its own frames (p_loan) and sleeps while the reader copies
+ * straight out of them. Since the writer is asleep the pages can't change under the
+ * reader, and the data is copied once instead of twice. A loan is only
+ * made while the buffer is empty and nothing else is written until it
+ * has been read, so the data stays in order.
+ *
+ * Each end is a vnode embedded in the pipe. When its last reference is
+ * dropped, VOP_RECLAIM marks the end closed; the pipe is freed when
+ * both ends are.
+ */
+struct pipe {
+	char *p_buf;
+	size_t p_size;
+	size_t p_head;
+	size_t p_count;
+	paddr_t p_loan[PIPE_LOANPAGES];	/* frames lent by a writer */
+	size_t p_loanlen;		/* bytes on loan */
+	size_t p_loanoff;		/* bytes of the loan already read */
+	int p_readopen;
+	int p_writeopen;
+	struct lock *p_lock;
+	struct cv *p_readcv;
+	struct cv *p_writecv;
+	struct vnode p_readvn;
+	struct vnode p_writevn;
+};
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	assert(p->p_loanlen == 0);
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+////////////////////////////////////////////////////////////
+// vnode operations
+
+/*
+ * Pipes can't be reached by name, so this is never called through
+ * vfs_open; accept it anyway.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * The real work of closing happens in pipe_reclaim.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	(void)v;
+	return 0;
+}
+
+/*
+ * Last reference to one end has gone. Wake anyone on the other end so
+ * they see EOF or EPIPE, and free the pipe if both ends are gone.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *p = v->vn_data;
+	int gone;
+
+	lock_acquire(p->p_lock);
+	if (v == &p->p_readvn) {
+		assert(p->p_readopen);
+		p->p_readopen = 0;
+		cv_broadcast(p->p_writecv, p->p_lock);
+	}
+	else {
+		assert(p->p_writeopen);
+		p->p_writeopen = 0;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+	VOP_KILL(v);
+	gone = !p->p_readopen && !p->p_writeopen;
+	lock_release(p->p_lock);
+
+	if (gone) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+/*
+ * Read whatever is buffered, up to the size of the request, waiting
+ * only if there is nothing at all.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t len, off;
+	int result = 0;
+
+	if (v != &p->p_readvn) {
+		return EBADF;
+	}
+
+	lock_acquire(p->p_lock);
+
+	while (p->p_count == 0 && p->p_loanoff == p->p_loanlen &&
+	       p->p_writeopen) {
+		cv_wait(p->p_readcv, p->p_lock);
+	}
+
+	/* At most two passes: up to the end of the buffer, then the rest */
+	while (p->p_count > 0 && uio->uio_resid > 0) {
+		len = p->p_size - p->p_head;
+		if (len > p->p_count) {
+			len = p->p_count;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+
+		result = uiomove(p->p_buf + p->p_head, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_head = (p->p_head + len) % p->p_size;
+		p->p_count -= len;
+	}
+
+	/* Then from a writer's pages, if one has lent us any */
+	while (result == 0 && p->p_loanoff < p->p_loanlen &&
+	       uio->uio_resid > 0) {
+		off = p->p_loanoff % PAGE_SIZE;
+		len = PAGE_SIZE - off;
+		if (len > p->p_loanlen - p->p_loanoff) {
+			len = p->p_loanlen - p->p_loanoff;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+
+		result = uiomove((char *)PADDR_TO_KVADDR(
+				     p->p_loan[p->p_loanoff / PAGE_SIZE]) + off,
+				 len, uio);
+		if (result) {
+			break;
+		}
+		p->p_loanoff += len;
+	}
+
+	cv_broadcast(p->p_writecv, p->p_lock);
+	lock_release(p->p_lock);
+	return result;
+}
+
+/*
+ * True if the rest of UIO starts on a page boundary in user memory and
+ * covers at least a page, so it can be lent instead of copied.
+ */
+static
+int
+pipe_canloan(struct uio *uio)
+{
+	vaddr_t va = (vaddr_t)uio->uio_iovec.iov_ubase;
+
+	return uio->uio_segflg == UIO_USERSPACE &&
+		uio->uio_space == curthread->t_vmspace &&
+		uio->uio_resid >= PAGE_SIZE &&
+		(va % PAGE_SIZE) == 0;
+}
+
+/*
+ * Lend the reader up to PIPE_LOANPAGES whole pages from the front of
+ * UIO and sleep until it has read them (or gone away). Hands back the
+ * number of bytes transferred, which is 0 if the first page isn't
+ * resident and the caller should copy instead. Called with p_lock held.
+ */
+static
+int
+pipe_loan(struct pipe *p, struct uio *uio, size_t *ret)
+{
+	vaddr_t va = (vaddr_t)uio->uio_iovec.iov_ubase;
+	size_t npages, i, len;
+	paddr_t pa;
+
+	*ret = 0;
+
+	while (p->p_readopen && (p->p_count > 0 || p->p_loanlen > 0)) {
+		cv_wait(p->p_writecv, p->p_lock);
+	}
+	if (!p->p_readopen) {
+		return EPIPE;
+	}
+
+	npages = 0;
+	while (npages < PIPE_LOANPAGES &&
+	       (npages + 1) * PAGE_SIZE <= uio->uio_resid) {
+		pa = vm_loanpage(va + npages * PAGE_SIZE);
+		if (pa == 0) {
+			break;
+		}
+		p->p_loan[npages++] = pa;
+	}
+	if (npages == 0) {
+		return 0;
+	}
+
+	p->p_loanlen = npages * PAGE_SIZE;
+	p->p_loanoff = 0;
+	cv_broadcast(p->p_readcv, p->p_lock);
+
+	while (p->p_readopen && p->p_loanoff < p->p_loanlen) {
+		cv_wait(p->p_writecv, p->p_lock);
+	}
+
+	len = p->p_loanoff;
+	for (i=0; i<npages; i++) {
+		vm_unloanpage(p->p_loan[i]);
+	}
+	p->p_loanlen = 0;
+	p->p_loanoff = 0;
+	cv_broadcast(p->p_writecv, p->p_lock);
+
+	/* The reader took LEN bytes straight from our pages */
+	uio->uio_iovec.iov_ubase = (userptr_t)(va + len);
+	uio->uio_iovec.iov_len -= len;
+	uio->uio_resid -= len;
+	uio->uio_offset += len;
+
+	*ret = len;
+	return (len < npages * PAGE_SIZE) ? EPIPE : 0;
+}
+
+/*
+ * Copy the request into the buffer, waiting for space as needed. A
+ * write of PIPE_BUF or less waits until it fits entirely; since we
+ * hold p_lock from then until it's all copied, no other write can get
+ * in between. Larger writes lend whole pages where they can, but only
+ * while what is left doesn't fit in the free space; a write that fits
+ * is copied in and returns without waiting for the reader.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *p = v->vn_data;
+	size_t orig, need, tail, len;
+	int result = 0;
+
+	if (v != &p->p_writevn) {
+		return EBADF;
+	}
+
+	orig = uio->uio_resid;
+
+	lock_acquire(p->p_lock);
+
+	while (uio->uio_resid > 0) {
+		if (orig > PIPE_BUF && pipe_canloan(uio) &&
+		    uio->uio_resid > p->p_size - p->p_count) {
+			result = pipe_loan(p, uio, &len);
+			if (result) {
+				break;
+			}
+			if (len > 0) {
+				continue;
+			}
+			/* Not resident; copying it in will fault it in */
+		}
+
+		need = (orig <= PIPE_BUF) ? uio->uio_resid : 1;
+		while (p->p_readopen &&
+		       (p->p_loanlen > 0 || p->p_size - p->p_count < need)) {
+			cv_wait(p->p_writecv, p->p_lock);
+		}
+		if (!p->p_readopen) {
+			result = EPIPE;
+			break;
+		}
+
+		tail = (p->p_head + p->p_count) % p->p_size;
+		len = p->p_size - p->p_count;
+		if (len > p->p_size - tail) {
+			len = p->p_size - tail;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+
+		result = uiomove(p->p_buf + tail, len, uio);
+		if (result) {
+			break;
+		}
+		p->p_count += len;
+		cv_broadcast(p->p_readcv, p->p_lock);
+	}
+
+	lock_release(p->p_lock);
+
+	/* Report a short write rather than losing what already went in */
+	if (result == EPIPE && uio->uio_resid < orig) {
+		result = 0;
+	}
+	return result;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+/*
+ * The size of a pipe is the number of bytes waiting to be read.
+ */
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *p = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO;
+	statbuf->st_nlink = 1;
+
+	lock_acquire(p->p_lock);
+	statbuf->st_size = p->p_count + (p->p_loanlen - p->p_loanoff);
+	lock_release(p->p_lock);
+
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, u_int32_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * Operations that are meaningless on pipes.
+ */
+
+static
+int
+pipe_badio(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_fsync(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_mmap(struct vnode *v)
+{
+	(void)v;
+	return EUNIMP;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+static
+int
+pipe_creat(struct vnode *v, const char *name, int excl, struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for both ends of a pipe.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_badio,     /* readlink */
+	pipe_badio,     /* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_fsync,
+	pipe_mmap,
+	pipe_truncate,
+	pipe_badio,     /* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_nameop,    /* mkdir */
+	pipe_link,
+	pipe_nameop,    /* remove */
+	pipe_nameop,    /* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+
+int
+pipe_create(size_t size, struct vnode **readret, struct vnode **writeret)
+{
+	struct pipe *p;
+	int result;
+
+	assert(size >= PIPE_BUF);
+
+	p = kmalloc(sizeof(struct pipe));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(size);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_lock = lock_create("pipe");
+	if (p->p_lock == NULL) {
+		goto nomem_buf;
+	}
+	p->p_readcv = cv_create("pipe-read");
+	if (p->p_readcv == NULL) {
+		goto nomem_lock;
+	}
+	p->p_writecv = cv_create("pipe-write");
+	if (p->p_writecv == NULL) {
+		goto nomem_readcv;
+	}
+
+	result = VOP_INIT(&p->p_readvn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		goto fail_writecv;
+	}
+	result = VOP_INIT(&p->p_writevn, &pipe_vnode_ops, NULL, p);
+	if (result) {
+		VOP_KILL(&p->p_readvn);
+		goto fail_writecv;
+	}
+
+	p->p_size = size;
+	p->p_head = 0;
+	p->p_count = 0;
+	p->p_loanlen = 0;
+	p->p_loanoff = 0;
+	p->p_readopen = 1;
+	p->p_writeopen = 1;
+
+	VOP_INCOPEN(&p->p_readvn);
+	VOP_INCOPEN(&p->p_writevn);
+
+	*readret = &p->p_readvn;
+	*writeret = &p->p_writevn;
+	return 0;
+
+ fail_writecv:
+	cv_destroy(p->p_writecv);
+	cv_destroy(p->p_readcv);
+	lock_destroy(p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+	return result;
+
+ nomem_readcv:
+	cv_destroy(p->p_readcv);
+ nomem_lock:
+	lock_destroy(p->p_lock);
+ nomem_buf:
+	kfree(p->p_buf);
+	kfree(p);
+	return ENOMEM;
+}
@@ -13,6 +13,7 @@
 #include <curthread.h>
 #include <vm.h>
 #include <vfs.h>
+#include <file.h>
 #include <test.h>
 
 /*
@@ -38,6 +39,20 @@ runprogram(char *progname, char **args, unsigned long nargs	)
 
 	/* We should be a new thread. */
 	assert(curthread->t_vmspace == NULL);
+	assert(curthread->t_filetable == NULL);
+
+	/* Give the process its standard input, output and error */
+	curthread->t_filetable = filetable_create();
+	if (curthread->t_filetable == NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+	result = filetable_stdio(curthread->t_filetable);
+	if (result) {
+		/* thread_exit closes whatever did get opened */
+		vfs_close(v);
+		return result;
+	}
 
 	/* Create a new address space. */
 	curthread->t_vmspace = as_create();
@@ -121,3 +121,19 @@ mk_kuio(struct uio *uio, void *kbuf, size_t len, off_t pos, enum uio_rw rw)
 	uio->uio_rw = rw;
 	uio->uio_space = NULL;
 }
+
+/*
+ * Likewise, for I/O to or from a buffer in the current process.
+ */
+void
+mk_uuio(struct uio *uio, userptr_t ubuf, size_t len, off_t pos,
+	enum uio_rw rw)
+{
+	uio->uio_iovec.iov_ubase = ubuf;
+	uio->uio_iovec.iov_len = len;
+	uio->uio_offset = pos;
+	uio->uio_resid = len;
+	uio->uio_segflg = UIO_USERSPACE;
+	uio->uio_rw = rw;
+	uio->uio_space = curthread->t_vmspace;
+}
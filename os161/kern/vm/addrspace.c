@@ -1,6 +1,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <synch.h>
 #include <addrspace.h>
 #include <vm.h>
 //#include <bitmap.h>
@@ -24,6 +25,17 @@ as_create(void)
 	}
 
 	as->as_regions = array_create();
+	as->as_regionlock = rwlock_create("as regions");
+	if (as->as_regions == NULL || as->as_regionlock == NULL) {
+		if (as->as_regions != NULL) {
+			array_destroy(as->as_regions);
+		}
+		if (as->as_regionlock != NULL) {
+			rwlock_destroy(as->as_regionlock);
+		}
+		kfree(as);
+		return NULL;
+	}
 	as->sheap = 0;
 	as->eheap = 0;
 
@@ -59,11 +71,13 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 
 void as_copy_regions(struct addrspace *newas, struct addrspace *source){
 	unsigned int i;
+	rwlock_acquire_read(source->as_regionlock);
 	for (i = 0; i < array_getnum(source->as_regions); i++) {
 		struct as_region* temp = kmalloc(sizeof(struct as_region));
 		*temp = *((struct as_region*)array_getguy(source->as_regions, i));
 		array_add(newas->as_regions, temp);
 	}
+	rwlock_release_read(source->as_regionlock);
 }
 
 void as_copy_heap(struct addrspace *newas, struct addrspace *source){
@@ -119,6 +133,9 @@ as_destroy(struct addrspace *as)
 	for (i; i < numberOfEntries; i++) {
 		if(COREMAP[i].state != 0 && COREMAP[i].as == as){
 			COREMAP[i].as = NULL;
+			// still on loan to a pipe; vm_unloanpage frees it
+			if (COREMAP[i].refcount > 0)
+				continue;
 			COREMAP[i].v_as = 0;
 			COREMAP[i].state = 0;
 			COREMAP[i].length = 0;
@@ -126,6 +143,7 @@ as_destroy(struct addrspace *as)
 	}
 
 	array_destroy(as->as_regions);
+	rwlock_destroy(as->as_regionlock);
 
 	for(i = 0; i < PT_SIZE; i++) {
 		if(as->as_ptes[i] != NULL)
@@ -185,6 +203,8 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	new_region->region_permis = 0;
 	new_region->region_permis = (readable | writeable | executable);
+
+	rwlock_acquire_write(as->as_regionlock);
 	array_add(as->as_regions, new_region);
 
 
@@ -192,6 +212,7 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		as->sheap = vaddr + npages * PAGE_SIZE;
 		as->eheap = as->sheap;
 	}
+	rwlock_release_write(as->as_regionlock);
 	return 0;
 }
 
@@ -199,12 +220,13 @@ int
 as_prepare_load(struct addrspace *as)
 {
 
+	rwlock_acquire_write(as->as_regionlock);
 	struct as_region* text = (struct as_region*)array_getguy(as->as_regions, 0); 
 
 	as->permissions = text->region_permis;
 
 	text->region_permis |= (PF_R | PF_W);
-
+	rwlock_release_write(as->as_regionlock);
 
 	return 0;
 }
@@ -213,9 +235,11 @@ int
 as_complete_load(struct addrspace *as)
 {
 
+	rwlock_acquire_write(as->as_regionlock);
 	struct as_region* text = (struct as_region*)array_getguy(as->as_regions, 0); 
 
 	text->region_permis = as->permissions;
+	rwlock_release_write(as->as_regionlock);
 	return 0;
 }
 
@@ -45,18 +45,19 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
-	switch (pid) {
-	    case -1:
-		return -1;
-	    case 0:
-		/* child */
-		execv(argv[0], argv);
-		/* exec only returns if it fails */
-		_exit(255);
-	    default:
-		/* parent */
-		waitpid(pid, &status, 0);
-		return status;
+	/* spawn saves copying our address space just to discard it */
+	pid = spawn(argv[0], argv);
+	if (pid < 0) {
+		/*
+		 * Report what fork+execv would have: -1 if no process
+		 * could be made, or else the 255 the child would have
+		 * exited with when exec failed.
+		 */
+		if (errno == EAGAIN || errno == ENOMEM) {
+			return -1;
+		}
+		return 255;
 	}
+	waitpid(pid, &status, 0);
+	return status;
 }
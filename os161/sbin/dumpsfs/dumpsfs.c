@@ -35,24 +35,23 @@ dumpsb(void)
 	if (SWAPL(sp.sp_magic) != SFS_MAGIC) {
 		errx(1, "Not an sfs filesystem");
 	}
+	if (SWAPL(sp.sp_version) > SFS_VERSION) {
+		errx(1, "Unknown sfs version %u", SWAPL(sp.sp_version));
+	}
 	sp.sp_volname[sizeof(sp.sp_volname)-1] = 0;
 	printf("Volume name: %-40s  %u blocks\n", sp.sp_volname, 
 	       SWAPL(sp.sp_nblocks));
+	printf("Version: %u\n", SWAPL(sp.sp_version));
 
 	return SWAPL(sp.sp_nblocks);
 }
 
 static
 void
-dodirblock(u_int32_t block)
+dodirents(struct sfs_dir *sds, int nsds)
 {
-	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
-	int nsds = SFS_BLOCKSIZE/sizeof(struct sfs_dir);
 	int i;
 
-	diskread(&sds, block);
-
-	printf("    [block %u]\n", block);
 	for (i=0; i<nsds; i++) {
 		u_int32_t ino = SWAPL(sds[i].sfd_ino);
 		if (ino==SFS_NOINO) {
@@ -65,12 +64,51 @@ dodirblock(u_int32_t block)
 	}
 }
 
+static
+void
+dodirblock(u_int32_t block)
+{
+	struct sfs_dir sds[SFS_BLOCKSIZE/sizeof(struct sfs_dir)];
+
+	diskread(&sds, block);
+
+	printf("    [block %u]\n", block);
+	dodirents(sds, SFS_BLOCKSIZE/sizeof(struct sfs_dir));
+}
+
+/*
+ * Dump the directory blocks in the tree of indirect blocks LEVELS
+ * deep whose top is IDBLOCK.
+ */
+static
+void
+dodirindirect(u_int32_t idblock, int levels, u_int32_t *nblocks)
+{
+	u_int32_t ib[SFS_DBPERIDB];
+	u_int32_t block;
+	int i;
+
+	diskread(&ib, idblock);
+	for (i=0; i<SFS_DBPERIDB; i++) {
+		block = SWAPL(ib[i]);
+		if (block == 0) {
+			continue;
+		}
+		if (levels > 1) {
+			dodirindirect(block, levels-1, nblocks);
+		}
+		else {
+			dodirblock(block);
+			(*nblocks)++;
+		}
+	}
+}
+
 static
 void
 dumpdir(u_int32_t ino)
 {
 	struct sfs_inode sfi;
-	u_int32_t ib[SFS_DBPERIDB];
 	int nentries, i;
 	u_int32_t block, nblocks=0;
 
@@ -82,6 +120,16 @@ dumpdir(u_int32_t ino)
 	}
 	printf("Directory %u: %d entries\n", ino, nentries);
 
+	if (SWAPL(sfi.sfi_flags) & SFS_IFLAG_INLINE) {
+		if (nentries * sizeof(struct sfs_dir) > SFS_INLINESIZE) {
+			warnx("Warning: inline dir is too large");
+			nentries = SFS_INLINESIZE / sizeof(struct sfs_dir);
+		}
+		printf("    [inline]\n");
+		dodirents((struct sfs_dir *)sfi.sfi_inline, nentries);
+		return;
+	}
+
 	for (i=0; i<SFS_NDIRECT; i++) {
 		block = SWAPL(sfi.sfi_direct[i]);
 		if (block) {
@@ -90,14 +138,13 @@ dumpdir(u_int32_t ino)
 		}
 	}
 	if (SWAPL(sfi.sfi_indirect)) {
-		diskread(&ib, SWAPL(sfi.sfi_indirect));
-		for (i=0; i<SFS_DBPERIDB; i++) {
-			block = SWAPL(ib[i]);
-			if (block) {
-				dodirblock(block);
-				nblocks++;
-			}
-		}
+		dodirindirect(SWAPL(sfi.sfi_indirect), 1, &nblocks);
+	}
+	if (SWAPL(sfi.sfi_dindirect)) {
+		dodirindirect(SWAPL(sfi.sfi_dindirect), 2, &nblocks);
+	}
+	if (SWAPL(sfi.sfi_tindirect)) {
+		dodirindirect(SWAPL(sfi.sfi_tindirect), 3, &nblocks);
 	}
 	printf("    %u blocks in directory\n", nblocks);
 }
@@ -50,6 +50,7 @@ writesuper(const char *volname, u_int32_t nblocks)
 
 	sp.sp_magic = SWAPL(SFS_MAGIC);
 	sp.sp_nblocks = SWAPL(nblocks);
+	sp.sp_version = SWAPL(SFS_VERSION);
 	strcpy(sp.sp_volname, volname);
 
 	diskwrite(&sp, SFS_SB_LOCATION);
@@ -66,6 +67,7 @@ writerootdir(void)
 	sfi.sfi_size = SWAPL(0);
 	sfi.sfi_type = SWAPS(SFS_TYPE_DIR);
 	sfi.sfi_linkcount = SWAPS(1);
+	sfi.sfi_flags = SWAPL(SFS_IFLAG_INLINE);
 
 	diskwrite(&sfi, SFS_ROOT_LOCATION);
 }
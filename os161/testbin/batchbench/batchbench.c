@@ -0,0 +1,138 @@
+/*
+ * batchbench - compare metadata-heavy syscall runs made one trap at a
+ * time with the same runs made through sysbatch().
+ *
+ * Each round opens NFILES files and then closes them all again, which
+ * is the shape of ls or dirtest: lots of small, independent calls.
+ *
+ * The files (bb-0 and so on) are left behind, since the kernel has no
+ * remove() yet; setup truncates them, so every run starts the same.
+ *
+ * Usage: batchbench [rounds]
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <kern/callno.h>
+
+#define NFILES   16
+#define NROUNDS  200
+
+static char names[NFILES][16];
+static int fds[NFILES];
+static struct sysreq reqs[NFILES];
+
+static
+void
+setup(void)
+{
+	int i, fd;
+
+	for (i=0; i<NFILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "bb-%d", i);
+		fd = open(names[i], O_WRONLY|O_CREAT|O_TRUNC);
+		if (fd < 0) {
+			err(1, "%s: open", names[i]);
+		}
+		close(fd);
+	}
+}
+
+static
+void
+round_plain(void)
+{
+	int i;
+
+	for (i=0; i<NFILES; i++) {
+		fds[i] = open(names[i], O_RDONLY);
+		if (fds[i] < 0) {
+			err(1, "%s: open", names[i]);
+		}
+	}
+	for (i=0; i<NFILES; i++) {
+		if (close(fds[i]) < 0) {
+			err(1, "close");
+		}
+	}
+}
+
+static
+void
+runbatch(void)
+{
+	int i;
+
+	if (sysbatch(reqs, NFILES) != NFILES) {
+		err(1, "sysbatch");
+	}
+	for (i=0; i<NFILES; i++) {
+		if (reqs[i].sr_error) {
+			errx(1, "batched call %d: %s", reqs[i].sr_callno,
+			     strerror(reqs[i].sr_error));
+		}
+	}
+}
+
+static
+void
+round_batched(void)
+{
+	int i;
+
+	for (i=0; i<NFILES; i++) {
+		reqs[i].sr_callno = SYS_open;
+		reqs[i].sr_args[0] = (u_int32_t)names[i];
+		reqs[i].sr_args[1] = O_RDONLY;
+	}
+	runbatch();
+
+	for (i=0; i<NFILES; i++) {
+		fds[i] = reqs[i].sr_retval;
+		reqs[i].sr_callno = SYS_close;
+		reqs[i].sr_args[0] = fds[i];
+	}
+	runbatch();
+}
+
+static
+void
+timeone(const char *name, void (*func)(void), int nrounds)
+{
+	time_t s1, s2;
+	unsigned long ns1, ns2;
+	unsigned long usecs;
+	int i;
+
+	s1 = __time(NULL, &ns1);
+	for (i=0; i<nrounds; i++) {
+		func();
+	}
+	s2 = __time(NULL, &ns2);
+
+	usecs = (s2 - s1) * 1000000 + ns2 / 1000 - ns1 / 1000;
+	printf("%-8s %d rounds of %d opens+closes: %lu us (%lu us/call)\n",
+	       name, nrounds, NFILES, usecs, usecs / (nrounds * NFILES * 2));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int nrounds = NROUNDS;
+
+	if (argc > 1) {
+		nrounds = atoi(argv[1]);
+	}
+	if (nrounds <= 0) {
+		errx(1, "Usage: batchbench [rounds]");
+	}
+
+	setup();
+	timeone("plain", round_plain, nrounds);
+	timeone("batched", round_batched, nrounds);
+
+	return 0;
+}
@@ -19,12 +19,7 @@ runprogram(char * args[])
 {
         pid_t pid;
 
-        if ((pid = fork()) == 0) {
-                execv(args[0], args);
-                warn("execv");
-                _exit(-1);
-        }
-        else if (pid > 0) {
+        if ((pid = spawn(args[0], args)) >= 0) {
                 int x; 
                 if (waitpid(pid, &x, 0) < 0) {
                         warn("waitpid");
@@ -36,7 +31,7 @@ runprogram(char * args[])
         }
         else
         {
-                warn("fork");
+                warn("spawn");
                 return -1;
         }
         
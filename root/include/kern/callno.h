@@ -40,6 +40,9 @@
 #define SYS___getcwd     29
 #define SYS_stat         30
 #define SYS_lstat        31
+#define SYS_spawn        32
+#define SYS_sysstat_reset 33
+#define SYS_sysbatch     34
 /*CALLEND*/
 
 
@@ -7,5 +7,11 @@
 /* Longest full path name */
 #define PATH_MAX   1024
 
+/* Longest argument list for exec, strings and pointers together */
+#define ARG_MAX    65536
+
+/* Largest write to a pipe that is guaranteed not to be interleaved */
+#define PIPE_BUF   512
+
 
 #endif /* _KERN_LIMITS_H_ */